@@ -0,0 +1,61 @@
+// Measure how page allocation scales with the number of CPUs.
+// Each of 1, 2, 4 and 8 processes repeatedly faults in a batch of
+// fresh pages and hands them back with madvise(MADV_DONTNEED), so
+// that nearly all of their time goes to kalloc() and kfree().
+// Run with CPUS=8 to see the processes on different CPUs; with
+// per-CPU magazines the time per round should stay roughly flat.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NPAGES  64
+#define ROUNDS  200
+
+void
+churn(void)
+{
+  char *p;
+  int i, r;
+
+  if((uint)sbrk(0) % 4096)
+    sbrk(4096 - (uint)sbrk(0) % 4096);
+  p = sbrk(NPAGES*4096);
+  if(p == (char*)-1){
+    printf(1, "allocbench: sbrk failed\n");
+    exit();
+  }
+  for(r = 0; r < ROUNDS; r++){
+    for(i = 0; i < NPAGES; i++)
+      p[i*4096] = r;
+    madvise(p, NPAGES*4096, MADV_DONTNEED);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, pid, t0, t1;
+
+  for(n = 1; n <= 8; n *= 2){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      pid = fork();
+      if(pid < 0){
+        printf(1, "allocbench: fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        churn();
+        exit();
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t1 = uptime();
+    printf(1, "%d procs: %d ticks for %d page allocations each\n",
+           n, t1 - t0, NPAGES*ROUNDS);
+  }
+  exit();
+}
@@ -5,6 +5,9 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
+  uchar **pages;     // if set, transfer npage whole pages here instead of data
+  uint npage;        //   (swap I/O only; never set on buffer cache blocks)
+  uint nsect;        // sectors of the current transfer done so far
   uchar data[BSIZE];
 };
 #define B_BUSY  0x1  // buffer is locked by some process
@@ -2,8 +2,10 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
+struct pstat;
 struct rtcdate;
 struct spinlock;
 struct stat;
@@ -41,6 +43,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+int             ilockfault(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -63,8 +66,22 @@ extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+extern uint     phystop;
+extern char*    zeropage;
 char*           kalloc(void);
+char*           kalloc_order(int);
+void            kalloctest(void);
+char*           kalloc_zeroed(void);
 void            kfree(char*);
+void            kfree_order(char*, int);
+int             kfreecount(void);
+void            kprezero(void);
+int             kgetslot(char*);
+void            ksetslot(char*, int);
+uint            kgetstamp(char*);
+void            ksetstamp(char*, uint);
+void            krefinc(char*);
+int             krefcnt(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -92,11 +109,26 @@ int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pcache.c
+char*           pcacheget(struct inode*, uint);
+void            pcacheinit(void);
+void            pcacheinval(struct inode*);
+void            pcacheput(struct inode*, uint, char*);
+int             pcacheshrink(int);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
+// pgpolicy.c
+void            pgfault(struct proc*, uint);
+void            pgmap(struct proc*, uint, char*);
+int             pgpolicy(int);
+void            pgunmap(struct proc*, uint, char*);
+int             pgvictim(struct proc*, uint*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -107,21 +139,53 @@ int             pipewrite(struct pipe*, char*, int);
 struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
+int             getpstat(struct pstat*, int);
 int             growproc(int);
 int             kill(int);
+int             madvise_dontneed(uint, uint);
+int             mmap(struct inode*, uint, uint, int);
+int             munmap(uint, uint);
+int             oomkill(void);
+void            kswapdinit(void);
+void            kswapdwake(void);
 void            pinit(void);
 void            procdump(void);
+void            reclaim_release(void);
+void            rsstrim(void);
+struct proc*    reclaim_victim(struct proc*, uint*);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            vmlock(void);
+void            vmunlock(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// swap.c
+int             swapalloc(int);
+void            swapdup(int);
+void            swapfree(int);
+void            swapinit(int);
+void            swapread(int, char**, int);
+void            swapwrite(int, char**, int);
+
+// zswap.c
+void            zswapdup(int);
+void            zswapfree(int);
+void            zswapinit(void);
+void            zswapread(int, char*);
+int             zswapstore(char*);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -153,6 +217,7 @@ void            timerinit(void);
 
 // trap.c
 void            idtinit(void);
+int             page_out(struct proc*);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -170,14 +235,17 @@ pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+int             unmapuvm(struct proc*, pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+extern int      cowfork;
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+uint            residentuvm(pde_t*, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -20,6 +20,9 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  struct proc *holder; // process that set I_BUSY
+  struct inode *next; // in icache.list
+  int pcached;        // may have pages in the page cache
 
   short type;         // copy of disk inode
   short major;
@@ -0,0 +1,64 @@
+// Time fork+exec from a process with a large, touched heap,
+// first with fork copying every resident page up front as it
+// used to, then copy-on-write.  With copy-on-write, fork shares
+// the parent's frames and exec throws the sharing away, so the
+// heap size should barely matter.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define HEAPSZ  (4*1024*1024)
+#define ROUNDS  20
+
+char *heap;
+char *childargv[] = { "forkbench", "child", 0 };
+
+void
+forkexec(void)
+{
+  int pid;
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "forkbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    exec("forkbench", childargv);
+    printf(1, "forkbench: exec failed\n");
+    exit();
+  }
+  wait();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, t0, t1, cow, old;
+
+  // The exec'd child has nothing to do.
+  if(argc > 1)
+    exit();
+
+  heap = sbrk(HEAPSZ);
+  if(heap == (char*)-1){
+    printf(1, "forkbench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < HEAPSZ; i += 4096)
+    heap[i] = 1;
+
+  old = cowfork(-1);
+  for(cow = 0; cow <= 1; cow++){
+    cowfork(cow);
+    t0 = uptime();
+    for(i = 0; i < ROUNDS; i++)
+      forkexec();
+    t1 = uptime();
+    printf(1, "fork+exec (%s): %d ticks for %d rounds, %d KB heap\n",
+           cow ? "copy-on-write" : "eager copy", t1 - t0, ROUNDS, HEAPSZ/1024);
+  }
+  cowfork(old);
+  exit();
+}
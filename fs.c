@@ -156,13 +156,15 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *list;       // inodes with references
 } icache;
 
 void
 iinit(int dev)
 {
   initlock(&icache.lock, "icache");
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d inodestart %d bmap start %d\n", sb.size,
           sb.nblocks, sb.ninodes, sb.nlog, sb.logstart, sb.inodestart, sb.bmapstart);
@@ -220,31 +222,41 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
+again:
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.list; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Allocate a new inode cache entry.  Free memory can run out
+  // for a while under memory pressure, and callers cannot cope
+  // with no inode, so reclaim and try again; someone else may
+  // have brought the inode in meanwhile.
+  if((ip = kmem_cache_alloc(icache.cache)) == 0){
+    if(proc == 0)
+      panic("iget: no memory");
+    release(&icache.lock);
+    if(page_out(0) < 0)
+      yield();
+    acquire(&icache.lock);
+    goto again;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  // Pages of an earlier incarnation may still be cached.
+  ip->pcached = 1;
+  ip->next = icache.list;
+  icache.list = ip;
   release(&icache.lock);
 
   return ip;
@@ -276,6 +288,7 @@ ilock(struct inode *ip)
   while(ip->flags & I_BUSY)
     sleep(ip, &icache.lock);
   ip->flags |= I_BUSY;
+  ip->holder = proc;
   release(&icache.lock);
 
   if(!(ip->flags & I_VALID)){
@@ -303,13 +316,32 @@ iunlock(struct inode *ip)
 
   acquire(&icache.lock);
   ip->flags &= ~I_BUSY;
+  ip->holder = 0;
   wakeup(ip);
   release(&icache.lock);
 }
 
+// Lock ip for the page fault handler, unless the current
+// process holds it already: a write() whose buffer is mapped
+// from the file being written faults inside writei().  Returns
+// 1 if it locked ip, in which case the caller must iunlock it.
+int
+ilockfault(struct inode *ip)
+{
+  int held;
+
+  acquire(&icache.lock);
+  held = (ip->flags & I_BUSY) && ip->holder == proc;
+  release(&icache.lock);
+  if(held)
+    return 0;
+  ilock(ip);
+  return 1;
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -317,6 +349,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -331,7 +365,12 @@ iput(struct inode *ip)
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0){
+    for(pp = &icache.list; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    kmem_cache_free(icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -416,6 +455,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcacheinval(ip);
 }
 
 // Copy stat information from inode.
@@ -475,6 +515,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->type == T_FILE)
+    pcacheinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
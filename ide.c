@@ -67,35 +67,61 @@ ideinit(void)
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
+// Number of sectors b transfers.
+static int
+idensect(struct buf *b)
+{
+  if(b->pages)
+    return b->npage * (PGSIZE/SECTOR_SIZE);
+  return BSIZE/SECTOR_SIZE;
+}
+
+// Memory for sector i of b's transfer.
+static uchar*
+idedata(struct buf *b, int i)
+{
+  int spp = PGSIZE/SECTOR_SIZE;
+
+  if(b->pages)
+    return b->pages[i/spp] + (i%spp)*SECTOR_SIZE;
+  return b->data + i*SECTOR_SIZE;
+}
+
 // Start the request for b.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
+  int nsect = idensect(b);
 
+  if(sector + nsect > (FSSIZE + NSWAPSLOT*SLOTBLOCKS) * sector_per_block)
+    panic("incorrect blockno");
   if (sector_per_block > 7) panic("idestart");
+  if (nsect > 256) panic("idestart: too many sectors");
   
+  b->nsect = 0;
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect & 0xff);  // number of sectors (0 means 256)
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, BSIZE/4);
+    idewait(0);
+    outsl(0x1f0, idedata(b, 0), SECTOR_SIZE/4);
   } else {
     outb(0x1f7, IDE_CMD_READ);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler.  The disk interrupts once per sector,
+// so a multi-sector transfer stays at the head of the queue
+// until its last sector is done.
 void
 ideintr(void)
 {
@@ -108,11 +134,20 @@ ideintr(void)
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
   if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+    insl(0x1f0, idedata(b, b->nsect), SECTOR_SIZE/4);
+
+  if(++b->nsect < idensect(b)){
+    if(b->flags & B_DIRTY){
+      idewait(0);
+      outsl(0x1f0, idedata(b, b->nsect), SECTOR_SIZE/4);
+    }
+    release(&idelock);
+    return;
+  }
+  idequeue = b->qnext;
   
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
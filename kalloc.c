@@ -1,6 +1,14 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and blocks of
+// 2^k physically contiguous pages for callers that need them.
+//
+// Free memory is managed by a buddy allocator: a free block of
+// 2^k pages starts at a multiple of 2^k pages, and is merged with
+// its buddy (the other half of the block of 2^(k+1) pages that
+// contains it) as soon as both are free.  An allocation splits
+// the smallest free block that is large enough, which keeps the
+// large blocks whole for as long as possible.
 
 #include "types.h"
 #include "defs.h"
@@ -8,30 +16,140 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "proc.h"
+
+#define MAXORDER 10          // largest block is 2^MAXORDER pages (4MB)
+#define PFN(v)   (v2p(v)/PGSIZE)
+#define PAGE(n)  ((char*)p2v((n)*PGSIZE))
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;          // only on the buddy lists
+};
+
+// Once every CPU is up, each CPU keeps up to KMAGAZINE free
+// pages of its own, so that kalloc() and kfree() normally take
+// only its magazine's lock, which no other CPU wants.  An empty
+// magazine is refilled from the buddy lists, and a full one gives
+// half its pages back, in batches of KMAGAZINE/2 under kmem.lock.
+// When the buddy lists are empty too, kalloc() takes a page from
+// another CPU's magazine rather than fail.
+struct magazine {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];  // free blocks of each order
+  int nfree;                 // pages in free blocks
+  struct magazine mag[NCPU];
 } kmem;
 
+// Up to NZEROED free pages that a CPU with nothing to run has
+// already zeroed, so that kalloc_zeroed() usually need not.
+// Only the struct run link in each page is not zero.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} zeroed;
+
+// Per-frame bookkeeping, indexed by physical page number.
+struct frame {
+  int slot;                  // swap slot holding a clean copy, or -1
+  int ref;                   // mappings and caches holding the frame
+  uint stamp;                // for the replacement policy (pgpolicy.c)
+  int freeorder;             // 1 + order if it starts a free block, else 0
+};
+static struct frame *frames;  // phystop/PGSIZE of them, just after end
+
+uint phystop;                 // end of the physical memory in use
+uint mbmagic, mbinfo;         // %eax and %ebx at entry (see entry.S)
+
+// An entry in the BIOS memory map that bootasm.S saves at E820MAP.
+struct e820 {
+  uint addr, addrhi;
+  uint len, lenhi;
+  uint type;                 // 1 if usable RAM
+};
+
+// Page of zeroes mapped read-only wherever a process has read
+// but not yet written a zero-fill page.  The reference taken
+// here is never dropped, so it is never freed.
+char *zeropage;
+
+// Find how much physical memory there is.  A multiboot loader
+// reports the memory above 1MB; otherwise use the usable region
+// of the BIOS memory map that starts at or below EXTMEM and runs
+// past it.  Holes further up are left alone: the kernel only
+// uses memory that is contiguous from 0.  Capped at PHYSMAX,
+// which is all the kernel can map below DEVSPACE.
+static uint
+memsize(void)
+{
+  uint *mb, top;
+  ushort mapend;
+  struct e820 *e, *ee;
+
+  top = 0;
+  if(mbmagic == 0x2BADB002 && mbinfo < BOOTMEM){
+    mb = p2v(mbinfo);
+    if(mb[0] & 1)
+      top = EXTMEM + mb[2]*1024;
+  } else {
+    mapend = *(ushort*)p2v(E820MAP);
+    if(mapend > E820MAP+4 && mapend <= E820MAP+4+E820MAX*sizeof(*e) &&
+       (mapend - E820MAP - 4) % sizeof(*e) == 0){
+      ee = p2v(mapend);
+      for(e = p2v(E820MAP+4); e < ee; e++){
+        if(e->type != 1 || e->addrhi != 0 || e->addr > EXTMEM)
+          continue;
+        if(e->lenhi != 0 || e->len > 0xFFFFFFFF - e->addr)
+          top = 0xFFFFFFFF;
+        else if(e->addr + e->len > top)
+          top = e->addr + e->len;
+      }
+    }
+  }
+  if(top <= EXTMEM)
+    top = PHYSDFLT;
+  if(top > PHYSMAX)
+    top = PHYSMAX;
+  return PGROUNDDOWN(top);
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
-// the pages mapped by entrypgdir on free list.
+// the pages mapped by entrypgdir on free list.  It first sizes
+// memory and puts the frame table at the start of those pages.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&zeroed.lock, "zeroed");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.mag[i].lock, "kmag");
   kmem.use_lock = 0;
+
+  phystop = memsize();
+  frames = (struct frame*)PGROUNDUP((uint)vstart);
+  vstart = frames + phystop/PGSIZE;
+  if((char*)vstart > (char*)vend)
+    panic("kinit1: frame table");
+  memset(frames, 0, phystop/PGSIZE * sizeof(*frames));
+  if((char*)vend > (char*)p2v(phystop))
+    vend = p2v(phystop);
   freerange(vstart, vend);
 }
 
@@ -40,6 +158,8 @@ kinit2(void *vstart, void *vend)
 {
   freerange(vstart, vend);
   kmem.use_lock = 1;
+  zeropage = kalloc();
+  memset(zeropage, 0, PGSIZE);
 }
 
 void
@@ -52,28 +172,211 @@ freerange(void *vstart, void *vend)
 }
 
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// The buddy lists.  Called with kmem.lock held once it is in use.
+
+static void
+pushfree(char *v, int k)
+{
+  struct run *r;
+
+  r = (struct run*)v;
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  frames[PFN(v)].freeorder = k + 1;
+}
+
+static void
+unlinkfree(char *v, int k)
+{
+  struct run *r;
+
+  r = (struct run*)v;
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  frames[PFN(v)].freeorder = 0;
+}
+
+// Free the block of 2^k pages at v, merging it with its buddy
+// for as long as the buddy is free as a whole.
+static void
+buddyfree(char *v, int k)
+{
+  uint n, b;
+
+  kmem.nfree += 1 << k;
+  n = PFN(v);
+  for(; k < MAXORDER; k++){
+    b = n ^ (1 << k);
+    if(b >= phystop/PGSIZE || frames[b].freeorder != k + 1)
+      break;
+    unlinkfree(PAGE(b), k);
+    n &= ~(1 << k);
+  }
+  pushfree(PAGE(n), k);
+}
+
+// Take a block of 2^k pages, splitting the smallest free block
+// that is large enough and freeing the halves not needed.
+static char*
+buddyalloc(int k)
+{
+  char *v;
+  int j;
+
+  for(j = k; j <= MAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > MAXORDER)
+    return 0;
+  v = (char*)kmem.free[j];
+  unlinkfree(v, j);
+  while(j > k){
+    j--;
+    pushfree(v + (PGSIZE << j), j);
+  }
+  kmem.nfree -= 1 << k;
+  return v;
+}
+
+// This CPU's magazine.
+static struct magazine*
+mymag(void)
+{
+  struct magazine *m;
+
+  pushcli();
+  m = &kmem.mag[cpu->id];
+  popcli();
+  return m;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, and free it once no references remain.  v normally
+// should have been returned by a call to kalloc().  (The
+// exception is when initializing the allocator; see kinit above.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct magazine *m;
+  int i;
 
-  if((uint)v % PGSIZE || v < end || v2p(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || v2p(v) >= phystop)
     panic("kfree");
 
+  if(xadd(&frames[PFN(v)].ref, -1) > 1)
+    return;
+  frames[PFN(v)].ref = 0;
+
+#ifdef JUNKFILL
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
+  m = mymag();
+  acquire(&m->lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  r->next = m->freelist;
+  m->freelist = r;
+  if(++m->nfree > KMAGAZINE){
+    acquire(&kmem.lock);
+    for(i = 0; i < KMAGAZINE/2; i++){
+      r = m->freelist;
+      m->freelist = r->next;
+      buddyfree((char*)r, 0);
+    }
+    m->nfree -= KMAGAZINE/2;
+    release(&kmem.lock);
+  }
+  release(&m->lock);
+}
+
+// Take a page from magazine m, refilling it from the buddy
+// lists if it is empty and refill is set.
+static struct run*
+magget(struct magazine *m, int refill)
+{
+  struct run *r;
+  char *v;
+
+  acquire(&m->lock);
+  if(m->freelist == 0 && refill){
+    acquire(&kmem.lock);
+    while(m->nfree < KMAGAZINE/2 && (v = buddyalloc(0)) != 0){
+      r = (struct run*)v;
+      r->next = m->freelist;
+      m->freelist = r;
+      m->nfree++;
+    }
     release(&kmem.lock);
+  }
+  r = m->freelist;
+  if(r){
+    m->freelist = r->next;
+    m->nfree--;
+  }
+  release(&m->lock);
+  return r;
+}
+
+// Give the pages in every magazine and in the zeroed pool back
+// to the buddy lists, where they can merge into larger blocks.
+// Pages in the pool are allocated as far as the buddy lists
+// know, so they must come back too, or a large block can fail
+// to form while kfreecount() reports plenty of memory.
+static void
+kdrain(void)
+{
+  struct magazine *m;
+  struct run *r;
+
+  for(m = kmem.mag; m < &kmem.mag[NCPU]; m++){
+    acquire(&m->lock);
+    acquire(&kmem.lock);
+    while((r = m->freelist) != 0){
+      m->freelist = r->next;
+      buddyfree((char*)r, 0);
+    }
+    m->nfree = 0;
+    release(&kmem.lock);
+    release(&m->lock);
+  }
+  acquire(&zeroed.lock);
+  acquire(&kmem.lock);
+  while((r = zeroed.freelist) != 0){
+    zeroed.freelist = r->next;
+    frames[PFN(r)].ref = 0;
+    buddyfree((char*)r, 0);
+  }
+  zeroed.nfree = 0;
+  release(&kmem.lock);
+  release(&zeroed.lock);
+}
+
+// Take a page from the zeroed pool, or return 0.
+static struct run*
+zget(void)
+{
+  struct run *r;
+
+  acquire(&zeroed.lock);
+  r = zeroed.freelist;
+  if(r){
+    zeroed.freelist = r->next;
+    zeroed.nfree--;
+  }
+  release(&zeroed.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -81,16 +384,223 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  struct run *r;
+  struct magazine *m;
+
+  if(!kmem.use_lock)
+    r = (struct run*)buddyalloc(0);
+  else {
+    m = mymag();
+    r = magget(m, 1);
+    // Out of memory here: look in the other magazines.
+    for(m = kmem.mag; r == 0 && m < &kmem.mag[NCPU]; m++)
+      r = magget(m, 0);
+    if(r == 0)
+      r = zget();
+  }
+  if(r){
+    frames[PFN(r)].slot = -1;
+    frames[PFN(r)].ref = 1;
+  }
+  // Wake the reclaim daemon before the list runs dry.
+  if(kmem.use_lock && kfreecount() < FREELO)
+    kswapdwake();
+  return (char*)r;
+}
+
+// Allocate a page of zeroes.  Returns 0 if the memory
+// cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+  char *v;
+
+  if(kmem.use_lock && (r = zget()) != 0){
+    r->next = 0;
+    frames[PFN(r)].slot = -1;
+    frames[PFN(r)].ref = 1;
+    return (char*)r;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Called by the scheduler when this CPU has nothing to run.
+// Zeroes one free page for the pool, unless the pool is full
+// or free memory is getting short.
+void
+kprezero(void)
 {
   struct run *r;
 
+  if(!kmem.use_lock || zeroed.nfree >= NZEROED || kfreecount() < FREEHI)
+    return;
+  if((r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  acquire(&zeroed.lock);
+  r->next = zeroed.freelist;
+  zeroed.freelist = r;
+  zeroed.nfree++;
+  release(&zeroed.lock);
+}
+
+// Allocate 2^k physically contiguous pages, starting at a
+// multiple of their size.  Returns 0 if the memory cannot be
+// allocated.  Free with kfree_order(v, k).
+char*
+kalloc_order(int k)
+{
+  char *v;
+  int i;
+
+  if(k == 0)
+    return kalloc();
+  if(k < 0 || k > MAXORDER)
+    return 0;
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  v = buddyalloc(k);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  if(v == 0 && kmem.use_lock){
+    // Pages sitting in magazines may be what keeps a
+    // large enough block from forming.
+    kdrain();
+    acquire(&kmem.lock);
+    v = buddyalloc(k);
+    release(&kmem.lock);
+  }
+  if(v == 0)
+    return 0;
+  for(i = 0; i < 1 << k; i++){
+    frames[PFN(v) + i].slot = -1;
+    frames[PFN(v) + i].ref = 1;
+  }
+  if(kmem.use_lock && kfreecount() < FREELO)
+    kswapdwake();
+  return v;
+}
+
+// Free the 2^k pages at v, which kalloc_order(k) returned.
+void
+kfree_order(char *v, int k)
+{
+  int i;
+
+  if(k == 0){
+    kfree(v);
+    return;
+  }
+  if(k < 0 || k > MAXORDER || PFN(v) % (1 << k) ||
+     v < end || v2p(v) + (PGSIZE << k) > phystop)
+    panic("kfree_order");
+  for(i = 0; i < 1 << k; i++)
+    frames[PFN(v) + i].ref = 0;
+#ifdef JUNKFILL
+  memset(v, 1, PGSIZE << k);
+#endif
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree(v, k);
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
 }
 
+// Boot-time check of the buddy allocator, which no caller
+// yet uses above order 0.  Allocates and frees blocks of
+// several orders, frees the halves of blocks separately to see
+// that they merge, and drains a magazine.  Panics on failure.
+void
+kalloctest(void)
+{
+  char *v;
+  int k;
+
+  for(k = 1; k <= MAXORDER; k += 3){
+    if((v = kalloc_order(k)) == 0)
+      panic("kalloctest: kalloc_order");
+    if(PFN(v) % (1 << k))
+      panic("kalloctest: alignment");
+    memset(v, 0, PGSIZE << k);
+    kfree_order(v, k);
+  }
+
+  acquire(&kmem.lock);
+  for(k = 1; k <= MAXORDER; k += 3){
+    if((v = buddyalloc(k)) == 0)
+      panic("kalloctest: buddyalloc");
+    buddyfree(v, k - 1);
+    buddyfree(v + (PGSIZE << (k - 1)), k - 1);
+    // Merged: the upper half is no longer a free block of its
+    // own, and the lower half is not one of order k-1.
+    if(frames[PFN(v) + (1 << (k - 1))].freeorder != 0 ||
+       frames[PFN(v)].freeorder == k)
+      panic("kalloctest: no merge");
+  }
+  release(&kmem.lock);
+
+  kfree(kalloc());
+  kdrain();
+  if(mymag()->nfree != 0)
+    panic("kalloctest: kdrain");
+}
+
+// Number of free pages, counting those in magazines
+// and the zeroed pool.
+// Not exact while other CPUs allocate and free.
+int
+kfreecount(void)
+{
+  struct magazine *m;
+  int n;
+
+  n = kmem.nfree + zeroed.nfree;
+  for(m = kmem.mag; m < &kmem.mag[NCPU]; m++)
+    n += m->nfree;
+  return n;
+}
+
+
+// Swap slot that holds a clean copy of the page at v, or -1.
+int
+kgetslot(char *v)
+{
+  return frames[v2p(v)/PGSIZE].slot;
+}
+
+void
+ksetslot(char *v, int slot)
+{
+  frames[v2p(v)/PGSIZE].slot = slot;
+}
+
+uint
+kgetstamp(char *v)
+{
+  return frames[v2p(v)/PGSIZE].stamp;
+}
+
+void
+ksetstamp(char *v, uint stamp)
+{
+  frames[v2p(v)/PGSIZE].stamp = stamp;
+}
+
+// Take another reference to the page at v, which the
+// caller already holds one reference to.
+void
+krefinc(char *v)
+{
+  xadd(&frames[v2p(v)/PGSIZE].ref, 1);
+}
+
+// Number of references to the page at v.
+int
+krefcnt(char *v)
+{
+  return frames[v2p(v)/PGSIZE].ref;
+}
@@ -17,7 +17,7 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
-  kinit1(end, P2V(4*1024*1024)); // phys page allocator
+  kinit1(end, P2V(BOOTMEM)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // collect info about this machine
   lapicinit();
@@ -30,13 +30,18 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcacheinit();    // executable page cache
+  zswapinit();     // compressed swap
   fileinit();      // file table
+  pipeinit();      // pipe buffers
   ideinit();       // disk
   if(!ismp)
     timerinit();   // uniprocessor timer
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(BOOTMEM), P2V(phystop)); // must come after startothers()
+  kalloctest();    // check the buddy allocator
   userinit();      // first user process
+  kswapdinit();    // page reclaim daemon
   // Finish setting up this processor in mpmain.
   mpmain();
 }
@@ -106,8 +111,13 @@ __attribute__((__aligned__(PGSIZE)))
 pde_t entrypgdir[NPDENTRIES] = {
   // Map VA's [0, 4MB) to PA's [0, 4MB)
   [0] = (0) | PTE_P | PTE_W | PTE_PS,
-  // Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
+  // Map VA's [KERNBASE, KERNBASE+BOOTMEM) to PA's [0, BOOTMEM),
+  // enough for kinit1() to place the frame table and the kernel
+  // page table for the largest memory.
   [KERNBASE>>PDXSHIFT] = (0) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+1] = (4<<20) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+2] = (8<<20) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+3] = (12<<20) | PTE_P | PTE_W | PTE_PS,
 };
 
 //PAGEBREAK!
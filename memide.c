@@ -37,7 +37,8 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  uchar *p;
+  uchar *p, *data;
+  int i, n;
 
   if(!(b->flags & B_BUSY))
     panic("iderw: buf not busy");
@@ -45,15 +46,19 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
+  n = b->pages ? b->npage*PGSIZE : BSIZE;
+  if(b->blockno + n/BSIZE > disksize)
     panic("iderw: block out of range");
 
   p = memdisk + b->blockno*BSIZE;
   
-  if(b->flags & B_DIRTY){
-    b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
-  } else
-    memmove(b->data, p, BSIZE);
+  for(i = 0; i < n; i += BSIZE){
+    data = b->pages ? b->pages[i/PGSIZE] + i%PGSIZE : b->data;
+    if(b->flags & B_DIRTY)
+      memmove(p + i, data, BSIZE);
+    else
+      memmove(data, p + i, BSIZE);
+  }
+  b->flags &= ~B_DIRTY;
   b->flags |= B_VALID;
 }
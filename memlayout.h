@@ -1,8 +1,12 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
+#define BOOTMEM 0x1000000           // Memory entrypgdir maps for the kernel
+#define PHYSMAX 0x7E000000          // Most memory the kernel can map (to DEVSPACE)
+#define PHYSDFLT 0xE000000          // Memory to assume if the boot loader says nothing
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
+#define E820MAP 0x500               // Where bootasm.S leaves the BIOS memory map
+#define E820MAX 32                  // Most entries it keeps
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
@@ -139,11 +139,20 @@ struct segdesc {
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
 #define PTE_MBZ         0x180   // Bits must be zero
+#define PTE_SWAP        0x200   // Not present; PTE_ADDR holds swap slot
+#define PTE_COW         0x400   // Read-only share of a writable page
+
+// Page fault error code bits
+#define FEC_WR          0x002   // Fault was caused by a write
+#define FEC_U           0x004   // Fault happened in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Swap slot in a PTE_SWAP entry
+#define PTE_SLOT(pte)   ((uint)(pte) >> PGSHIFT)
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
@@ -2,13 +2,27 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXSEG        4  // max loadable segments per executable
+#define NMMAP         8  // mmap regions per process
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define NSWAPSLOT    2048  // page-sized swap slots after the file system
+#define SWAPCLUSTER     8  // max pages moved by one swap transfer
+#define ZPOOLPAGES    256  // max pages holding compressed swap
+#define NZEROED        64  // free pages idle CPUs keep zeroed
+#define KMAGAZINE      64  // most free pages cached per CPU
+#define FREELO        256  // kswapd wakes when fewer pages are free
+#define FREEHI       1024  // kswapd reclaims until this many are free
+#define FAULTAROUND     4  // extra cached executable pages mapped per text fault
+#define NPCACHE       256  // pages in the executable page cache
+#define NSLABCACHE      8  // slab allocator caches
+#define WSTAU        1024  // faults a page stays in the working set (WSClock)
+#define PGSCAN         64  // pages FIFO and WSClock examine per victim
+#define HANDSCAN     1024  // most page table entries a hand examines per victim
+#define OOMRETRY       16  // failed reclaims before a fault kills a process
 
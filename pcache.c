@@ -0,0 +1,147 @@
+// Page cache for executables.
+//
+// Processes running the same binary share the frames that hold
+// its file-backed pages instead of each reading a private copy.
+// Entries are keyed by (dev, inum, offset) and hold a reference
+// to their frame (see krefinc), so a page stays cached after the
+// processes mapping it exit and the next exec of the binary finds
+// it without going to the disk.
+//
+// Cached pages are only ever mapped read-only.  Writing to one
+// that belongs to a writable segment makes the fault handler
+// give the process a private copy.
+//
+// Writing or truncating a file drops its cached pages.  The table
+// is small and scanned linearly, like the buffer cache; when it is
+// full an entry that no process maps makes room for the new one.
+// ip->pcached spares writes to ordinary files the scan: it is set
+// when a page of ip is cached and cleared once a scan drops them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;      // file offset of the page
+  char *mem;     // 0 if the entry is unused
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  int hand;      // where to look for an entry to replace
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page of ip at offset off with a reference
+// taken for the caller, or 0 if it is not cached.
+char*
+pcacheget(struct inode *ip, uint off)
+{
+  struct pcpage *p;
+  char *mem;
+
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    if(p->mem && p->dev == ip->dev && p->inum == ip->inum && p->off == off){
+      mem = p->mem;
+      krefinc(mem);
+      release(&pcache.lock);
+      return mem;
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Enter mem, just read from ip at offset off, in the cache.
+// The cache takes its own reference.  Does nothing if the page
+// is already cached or every entry is in use.
+void
+pcacheput(struct inode *ip, uint off, char *mem)
+{
+  struct pcpage *p, *victim;
+  int i;
+
+  acquire(&pcache.lock);
+  victim = 0;
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    if(p->mem && p->dev == ip->dev && p->inum == ip->inum && p->off == off){
+      release(&pcache.lock);
+      return;
+    }
+    if(victim == 0 && p->mem == 0)
+      victim = p;
+  }
+  // No free entry: replace one that only the cache refers to.
+  for(i = 0; victim == 0 && i < NPCACHE; i++){
+    p = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(krefcnt(p->mem) == 1){
+      kfree(p->mem);
+      victim = p;
+    }
+  }
+  if(victim){
+    krefinc(mem);
+    ip->pcached = 1;
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->off = off;
+    victim->mem = mem;
+  }
+  release(&pcache.lock);
+}
+
+// Drop the cached pages of ip after its contents change.
+// Processes still mapping them keep the old contents.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  if(!ip->pcached){
+    release(&pcache.lock);
+    return;
+  }
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    if(p->mem && p->dev == ip->dev && p->inum == ip->inum){
+      kfree(p->mem);
+      p->mem = 0;
+    }
+  }
+  ip->pcached = 0;
+  release(&pcache.lock);
+}
+
+// Free up to n cached pages that no process maps.
+// Returns the number freed.
+int
+pcacheshrink(int n)
+{
+  struct pcpage *p;
+  int freed;
+
+  freed = 0;
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE] && freed < n; p++){
+    if(p->mem && krefcnt(p->mem) == 1){
+      kfree(p->mem);
+      p->mem = 0;
+      freed++;
+    }
+  }
+  release(&pcache.lock);
+  return freed;
+}
@@ -0,0 +1,140 @@
+// Compare the page replacement policies.  Each access pattern is
+// replayed over an array that does not fit in the resident set
+// limit the benchmark sets for itself, once under each policy,
+// and the page faults it takes are reported.  The policy is
+// global, so other processes page under it too while this runs.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+#include "fcntl.h"
+
+#define NPAGES  256              // pages in the array
+#define FRAMES  128              // of which this many may be resident
+#define NTOUCH  4096             // touches per pattern
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+struct pstat ps[NPROC];
+char *buf;
+uint seed = 1;
+
+char *policyname[] = {
+[PGP_FIFO]    "fifo",
+[PGP_CLOCK]   "clock",
+[PGP_WSCLOCK] "wsclock",
+};
+
+char *patternname[] = { "sequential", "random", "looping" };
+
+uint
+faults(void)
+{
+  int i, n, pid;
+
+  pid = getpid();
+  n = getpstat(ps, NPROC);
+  for(i = 0; i < n; i++)
+    if(ps[i].pid == pid)
+      return ps[i].minflt + ps[i].majflt;
+  return 0;
+}
+
+uint
+rss(void)
+{
+  int i, n, pid;
+
+  pid = getpid();
+  n = getpstat(ps, NPROC);
+  for(i = 0; i < n; i++)
+    if(ps[i].pid == pid)
+      return ps[i].rss;
+  return 0;
+}
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+touch(int pg)
+{
+  buf[pg*4096 + pg % 4096]++;
+}
+
+// Replay pattern n and return the faults it took.
+//   sequential: a window of FRAMES/2 pages slides along the array.
+//   random: three touches in four go to a quarter of the array,
+//     the rest anywhere in it.
+//   looping: repeated passes over a quarter more pages than fit.
+uint
+replay(int n)
+{
+  int i, j, pg;
+  uint f0;
+
+  seed = 1;
+  f0 = faults();
+  switch(n){
+  case 0:
+    for(i = 0, pg = 0; i < NTOUCH; pg = (pg + 1) % NPAGES)
+      for(j = 0; j < FRAMES/2 && i < NTOUCH; j++, i++)
+        touch((pg + j) % NPAGES);
+    break;
+  case 1:
+    for(i = 0; i < NTOUCH; i++){
+      if(rand() % 4)
+        touch(rand() % (NPAGES/4));
+      else
+        touch(rand() % NPAGES);
+    }
+    break;
+  case 2:
+    for(i = 0; i < NTOUCH; i++)
+      touch(i % (FRAMES + FRAMES/4));
+    break;
+  }
+  return faults() - f0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int old, pol, pat;
+  uint f;
+
+  if((uint)sbrk(0) % 4096)
+    sbrk(4096 - (uint)sbrk(0) % 4096);
+  buf = sbrk(NPAGES*4096);
+  if(buf == (char*)-1){
+    printf(2, "pgbench: sbrk failed\n");
+    exit();
+  }
+  old = pgpolicy(-1);
+  rsslimit(rss() + FRAMES);
+  printf(1, "%d pages, %d resident, %d touches\n", NPAGES, FRAMES, NTOUCH);
+  printf(1, "pattern     ");
+  for(pol = 0; pol < NELEM(policyname); pol++)
+    printf(1, " %s", policyname[pol]);
+  printf(1, "\n");
+  for(pat = 0; pat < NELEM(patternname); pat++){
+    printf(1, "%s", patternname[pat]);
+    for(f = strlen(patternname[pat]); f < 12; f++)
+      printf(1, " ");
+    for(pol = 0; pol < NELEM(policyname); pol++){
+      madvise(buf, NPAGES*4096, MADV_DONTNEED);
+      pgpolicy(pol);
+      f = replay(pat);
+      printf(1, " %d", f);
+    }
+    printf(1, "\n");
+  }
+  pgpolicy(old);
+  exit();
+}
@@ -0,0 +1,283 @@
+// Page replacement policies.
+//
+// page_out() asks the current policy which page of a process to
+// evict next, and the fault handler tells it about faults and
+// newly mapped pages.  A policy is a table of hooks; those it
+// has no use for are left 0.
+//
+//   FIFO     evicts the page that has been mapped longest,
+//            whether or not it is still in use.
+//   CLOCK    sweeps a hand over each address space and gives
+//            pages with PTE_A set a second chance.
+//   WSClock  is CLOCK with a working-set window: a page is only
+//            evicted once it has gone WSTAU faults without being
+//            referenced, and clean pages go before dirty ones,
+//            which would cost a write.
+//
+// All three walk each address space with a hand (p->clockhand).
+// Choosing a victim looks at no more than HANDSCAN page table
+// and page directory entries, so that a large, sparse or mostly
+// swapped-out process does not mean walking its whole page table
+// with ptable.lock held: if the hand finds nothing in that many,
+// the policy asks to be called again.  FIFO and WSClock also
+// stop after PGSCAN present pages, so FIFO evicts the oldest
+// page near the hand, which is only an approximation of the
+// oldest page of all.
+//
+// FIFO and WSClock keep a time stamp with each frame (see
+// kgetstamp).  Frames shared between processes share a stamp,
+// which is good enough for a heuristic.  Time is counted in page
+// faults rather than clock ticks, so that a process which does
+// nothing but fault still sees its pages age.
+//
+// The policy is chosen at boot by PGPOLICY (make POLICY=FIFO,
+// CLOCK or WSCLOCK) and can be changed later with pgpolicy().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "pstat.h"
+
+#ifndef PGPOLICY
+#define PGPOLICY PGP_CLOCK
+#endif
+
+pte_t *walkpgdir(pde_t *pgdir, const void *va, int alloc);
+
+struct pgpolicy {
+  char *name;
+  void (*on_fault)(struct proc*, uint);          // p faulted at va
+  void (*on_map)(struct proc*, uint, char*);     // frame now maps va in p
+  int (*select_victim)(struct proc*, uint*);     // see pgvictim
+  void (*on_unmap)(struct proc*, uint, char*);   // va no longer maps frame in p
+};
+
+static uint fifoseq;     // FIFO: pages mapped so far
+static uint wsnow;       // WSClock: faults so far
+
+// Advance p's hand to the next present user page below sz,
+// examining at most *budget entries and counting them off.
+// Returns the page's PTE and sets *va.  Returns 0 with *budget
+// at 0 if the budget ran out first, or with *budget left over
+// once the hand has gone a whole sweep, over this call and
+// earlier ones, without finding such a page.
+static pte_t*
+handnext(struct proc *p, int *budget, uint *va)
+{
+  pte_t *pte;
+  uint a, next;
+
+  while(*budget > 0){
+    if(p->clockidle >= p->sz){
+      p->clockidle = 0;
+      return 0;
+    }
+    (*budget)--;
+    a = p->clockhand;
+    if(a >= p->sz)
+      a = 0;
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+      next = PGADDR(PDX(a) + 1, 0, 0);
+      p->clockidle += next - a;
+      p->clockhand = next;
+      continue;
+    }
+    p->clockidle += PGSIZE;
+    p->clockhand = a + PGSIZE;
+    if((*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U)){
+      p->clockidle = 0;
+      *va = a;
+      return pte;
+    }
+  }
+  return 0;
+}
+
+static void
+fifo_map(struct proc *p, uint va, char *mem)
+{
+  ksetstamp(mem, ++fifoseq);
+}
+
+// Evict the page mapped longest ago among the next PGSCAN
+// present pages after p's hand.  It is restamped as if just
+// mapped, so that if page_out() decides to keep it the next
+// choice is a different page.
+static int
+fifo_victim(struct proc *p, uint *va)
+{
+  pte_t *pte, *oldest;
+  uint a, age, max;
+  int seen, budget;
+
+  oldest = 0;
+  max = 0;
+  budget = HANDSCAN;
+  for(seen = 0; seen < PGSCAN && (pte = handnext(p, &budget, &a)) != 0; seen++){
+    age = fifoseq - kgetstamp(p2v(PTE_ADDR(*pte)));
+    if(oldest == 0 || age > max){
+      oldest = pte;
+      max = age;
+      *va = a;
+    }
+  }
+  if(oldest == 0)
+    return budget > 0 ? -1 : 0;
+  ksetstamp(p2v(PTE_ADDR(*oldest)), ++fifoseq);
+  return 1;
+}
+
+// Advance p's hand to the next present user page and examine
+// it.  If the page has been referenced since the hand last
+// passed, clear PTE_A and return 0 to give it a second chance.
+// Otherwise set *va to it and return 1.  Returns 0 as well if
+// the hand found no page within HANDSCAN entries, or -1 if a
+// full sweep finds no present user page.
+static int
+clock_victim(struct proc *p, uint *va)
+{
+  pte_t *pte;
+  int budget;
+
+  budget = HANDSCAN;
+  if((pte = handnext(p, &budget, va)) == 0)
+    return budget > 0 ? -1 : 0;
+  if(*pte & PTE_A){
+    *pte &= ~PTE_A;
+    return 0;
+  }
+  return 1;
+}
+
+static void
+ws_fault(struct proc *p, uint va)
+{
+  wsnow++;
+}
+
+static void
+ws_map(struct proc *p, uint va, char *mem)
+{
+  ksetstamp(mem, wsnow);
+}
+
+// Move p's hand over the next PGSCAN present pages.
+// Referenced pages have PTE_A cleared and their time of last
+// use brought up to date.  The first clean page that has dropped
+// out of the working set is the victim.  If there is none, take
+// an old dirty page, or failing that the least recently used
+// one.  The victim is restamped so that the next pass skips it
+// if page_out() keeps it.
+static int
+wsclock_victim(struct proc *p, uint *va)
+{
+  pte_t *pte, *dirty, *lru;
+  char *mem;
+  uint a, age, max, dva, lva;
+  int seen, budget;
+
+  dirty = lru = 0;
+  max = dva = lva = 0;
+  budget = HANDSCAN;
+  for(seen = 0; seen < PGSCAN && (pte = handnext(p, &budget, &a)) != 0; seen++){
+    mem = p2v(PTE_ADDR(*pte));
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      ksetstamp(mem, wsnow);
+      continue;
+    }
+    age = wsnow - kgetstamp(mem);
+    if(age > WSTAU){
+      if(!(*pte & PTE_D)){
+        *va = a;
+        ksetstamp(mem, wsnow);
+        return 1;
+      }
+      if(dirty == 0){
+        dirty = pte;
+        dva = a;
+      }
+    }
+    if(lru == 0 || age > max){
+      lru = pte;
+      lva = a;
+      max = age;
+    }
+  }
+  if(dirty){
+    pte = dirty;
+    *va = dva;
+  } else if(lru){
+    pte = lru;
+    *va = lva;
+  } else if(seen > 0 || budget == 0)
+    return 0;    // every page seen was referenced, or none found yet
+  else
+    return -1;
+  ksetstamp(p2v(PTE_ADDR(*pte)), wsnow);
+  return 1;
+}
+
+static struct pgpolicy policies[] = {
+[PGP_FIFO]    { "fifo",    0,        fifo_map, fifo_victim,    0 },
+[PGP_CLOCK]   { "clock",   0,        0,        clock_victim,   0 },
+[PGP_WSCLOCK] { "wsclock", ws_fault, ws_map,   wsclock_victim, 0 },
+};
+
+static struct pgpolicy *policy = &policies[PGPOLICY];
+
+// Called by the fault handler on every fault at va.
+void
+pgfault(struct proc *p, uint va)
+{
+  if(policy->on_fault)
+    policy->on_fault(p, va);
+}
+
+// Called when frame mem is mapped at user address va in p.
+void
+pgmap(struct proc *p, uint va, char *mem)
+{
+  if(policy->on_map)
+    policy->on_map(p, va, mem);
+}
+
+// Called whenever the page at va in p stops mapping frame mem,
+// before mem is released: when page_out() evicts it, when sbrk,
+// munmap, madvise, exec or exit drop it (see unmapuvm), and when
+// a copy-on-write fault gives p a private copy.
+void
+pgunmap(struct proc *p, uint va, char *mem)
+{
+  if(policy->on_unmap)
+    policy->on_unmap(p, va, mem);
+}
+
+// Choose a page of p to evict.  Returns 1 and sets *va, 0 if
+// the policy should be asked again, having given a page a
+// second chance or used up its HANDSCAN budget, or -1 if p has
+// no present user page.  Called with ptable.lock held, with p
+// not running.
+int
+pgvictim(struct proc *p, uint *va)
+{
+  return policy->select_victim(p, va);
+}
+
+// Switch to policy n, or just report the current one if n < 0.
+// Returns the previous policy, or -1 if n is not a policy.
+int
+pgpolicy(int n)
+{
+  int old;
+
+  old = policy - policies;
+  if(n >= (int)NELEM(policies))
+    return -1;
+  if(n >= 0)
+    policy = &policies[n];
+  return old;
+}
@@ -6,10 +6,12 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "pstat.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct spinlock vm[NPROC];  // guards proc[i].vmbusy; see vmlock
 } ptable;
 
 static struct proc *initproc;
@@ -19,11 +21,19 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static uint procrss(struct proc *p);
+pte_t *walkpgdir(pde_t *pgdir, const void *va, int alloc);
+
+static int reclaimhand;  // index into ptable.proc of the global clock hand
 
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NPROC; i++)
+    initlock(&ptable.vm[i], "vm");
 }
 
 //PAGEBREAK: 32
@@ -47,6 +57,16 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->clockhand = 0;
+  p->clockidle = 0;
+  p->vmbusy = 0;
+  p->reclaimer = 0;
+  p->rsslimit = 0;
+  p->ipgswp2 = 0;
+  p->nseg = 0;
+  memset(p->mmap, 0, sizeof(p->mmap));
+  p->minflt = p->majflt = 0;
+  p->nswapin = p->nswapout = 0;
   release(&ptable.lock);
 
   // Allocate kernel stack.
@@ -107,21 +127,138 @@ userinit(void)
 int
 growproc(int n)
 {
+  struct mmap *mm;
   uint sz;
   
   sz = proc->sz;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
+    // Pages are allocated when they are first touched.
+    if(sz + n < sz || sz + n >= KERNBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
+    if(-n > sz)
       return -1;
+    for(mm = proc->mmap; mm < &proc->mmap[NMMAP]; mm++)
+      if(mm->len && mm->addr + mm->len > sz + n)
+        return -1;
   }
+  vmlock();
+  if(n < 0)
+    sz = unmapuvm(proc, proc->pgdir, sz, sz + n);
   proc->sz = sz;
+  vmunlock();
+  switchuvm(proc);
+  return 0;
+}
+
+// Drop the pages in [addr, addr+len), freeing their frames
+// and swap slots.  The range stays part of the address space:
+// touching it again faults in zeroes, or the contents of the
+// file that backs it.  The stack guard page, which the user
+// cannot touch, is left alone so that it still catches stack
+// overflow.  Returns 0, or -1 if the range is bad.
+int
+madvise_dontneed(uint addr, uint len)
+{
+  uint a, end;
+  pte_t *pte;
+
+  end = PGROUNDUP(addr + len);
+  if(addr % PGSIZE != 0 || end < addr || end > PGROUNDUP(proc->sz))
+    return -1;
+  vmlock();
+  for(a = addr; a < end; a += PGSIZE){
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(pte && (*pte & (PTE_P|PTE_U)) == PTE_P)
+      continue;
+    unmapuvm(proc, proc->pgdir, a + PGSIZE, a);
+  }
+  vmunlock();
   switchuvm(proc);
   return 0;
 }
 
+// Map len bytes of ip from offset off, or zero-filled memory
+// if ip is 0, at the top of the address space.  Pages are
+// filled in on demand by the page fault handler.  Takes its
+// own reference to ip.  Returns the address, or -1.
+int
+mmap(struct inode *ip, uint len, uint off, int prot)
+{
+  struct mmap *mm;
+  uint addr;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  for(mm = proc->mmap; mm < &proc->mmap[NMMAP]; mm++)
+    if(mm->len == 0)
+      break;
+  if(mm == &proc->mmap[NMMAP])
+    return -1;
+  addr = PGROUNDUP(proc->sz);
+  len = PGROUNDUP(len);
+  if(len == 0 || addr + len < addr || addr + len >= KERNBASE)
+    return -1;
+  vmlock();
+  mm->addr = addr;
+  mm->len = len;
+  mm->ip = ip ? idup(ip) : 0;
+  mm->off = off;
+  mm->prot = prot;
+  proc->sz = addr + len;
+  vmunlock();
+  return addr;
+}
+
+// Unmap [addr, addr+len), which must be a whole mapping or
+// either end of one.  If it was at the top of the address
+// space the process shrinks; otherwise the hole reads as
+// zeroes, like memory from sbrk.  Returns 0, or -1.
+int
+munmap(uint addr, uint len)
+{
+  struct mmap *mm;
+  struct inode *ip;
+  uint end;
+
+  len = PGROUNDUP(len);
+  end = addr + len;
+  if(addr % PGSIZE != 0 || len == 0 || end < addr)
+    return -1;
+  for(mm = proc->mmap; mm < &proc->mmap[NMMAP]; mm++)
+    if(mm->len && addr >= mm->addr && end <= mm->addr + mm->len)
+      break;
+  if(mm == &proc->mmap[NMMAP])
+    return -1;
+  if(addr != mm->addr && end != mm->addr + mm->len)
+    return -1;
+
+  vmlock();
+  unmapuvm(proc, proc->pgdir, end, addr);
+  ip = 0;
+  if(len == mm->len){
+    ip = mm->ip;
+    mm->ip = 0;
+    mm->len = 0;
+  } else if(addr == mm->addr){
+    mm->addr = end;
+    mm->off += len;
+    mm->len -= len;
+  } else
+    mm->len -= len;
+  if(end == proc->sz)
+    proc->sz = addr;
+  vmunlock();
+  switchuvm(proc);
+  if(ip){
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+  return 0;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -136,13 +273,17 @@ fork(void)
     return -1;
 
   // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  vmlock();
+  np->pgdir = copyuvm(proc->pgdir, proc->sz);
+  vmunlock();
+  if(np->pgdir == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = proc->sz;
+  np->rsslimit = proc->rsslimit;
   np->parent = proc;
   *np->tf = *proc->tf;
 
@@ -153,6 +294,15 @@ fork(void)
     if(proc->ofile[i])
       np->ofile[i] = filedup(proc->ofile[i]);
   np->cwd = idup(proc->cwd);
+  if(proc->ipgswp2)
+    np->ipgswp2 = idup(proc->ipgswp2);
+  memmove(np->seg, proc->seg, sizeof(proc->seg));
+  np->nseg = proc->nseg;
+  for(i = 0; i < NMMAP; i++){
+    np->mmap[i] = proc->mmap[i];
+    if(np->mmap[i].ip)
+      idup(np->mmap[i].ip);
+  }
 
   safestrcpy(np->name, proc->name, sizeof(proc->name));
  
@@ -186,10 +336,26 @@ exit(void)
     }
   }
 
+  // Free user memory now rather than when the parent waits,
+  // so that a process the OOM killer picked gives it back
+  // promptly.
+  vmlock();
+  unmapuvm(proc, proc->pgdir, proc->sz, 0);
+  proc->sz = 0;
+  vmunlock();
+  lcr3(v2p(proc->pgdir));
+
   begin_op();
   iput(proc->cwd);
+  if(proc->ipgswp2)
+    iput(proc->ipgswp2);
+  for(fd = 0; fd < NMMAP; fd++)
+    if(proc->mmap[fd].ip)
+      iput(proc->mmap[fd].ip);
   end_op();
   proc->cwd = 0;
+  proc->ipgswp2 = 0;
+  memset(proc->mmap, 0, sizeof(proc->mmap));
 
   acquire(&ptable.lock);
 
@@ -266,16 +432,19 @@ void
 scheduler(void)
 {
   struct proc *p;
+  int ran;
 
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || p->reclaimer)
         continue;
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -292,6 +461,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: get a page ready for kalloc_zeroed().
+    if(!ran)
+      kprezero();
   }
 }
 
@@ -341,6 +513,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
   
   // Return to "caller", actually trapret (see allocproc).
@@ -428,6 +601,96 @@ kill(int pid)
   return -1;
 }
 
+// Kill the process with the most resident pages, to get
+// memory back when reclaim cannot keep up.  Kills no one while
+// a process that has already been killed still holds memory:
+// it is on its way back, and killing more for every retry while
+// it exits would take out one process after another.
+// Returns the pid, or -1 if no process was killed.
+int
+oomkill(void)
+{
+  struct proc *p, *victim;
+  uint rss, most;
+  int pid;
+
+  acquire(&ptable.lock);
+  victim = 0;
+  most = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE)
+      continue;
+    rss = procrss(p);
+    if(p->killed && rss > 0){
+      release(&ptable.lock);
+      return -1;
+    }
+    if(p->killed || p == initproc)
+      continue;
+    if(rss > most){
+      most = rss;
+      victim = p;
+    }
+  }
+  if(victim == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  victim->killed = 1;
+  if(victim->state == SLEEPING)
+    victim->state = RUNNABLE;
+  pid = victim->pid;
+  cprintf("out of memory: killed pid %d %s (%d pages)\n",
+          pid, victim->name, most);
+  release(&ptable.lock);
+  return pid;
+}
+
+//PAGEBREAK: 20
+// Page reclaim daemon.  Runs entirely in the kernel: sleeps
+// until kalloc() sees fewer than FREELO free pages, then evicts
+// until FREEHI pages are free so faulting processes normally
+// find a frame without paging anything out themselves.
+static void
+kswapd(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+
+  for(;;){
+    while(kfreecount() < FREEHI)
+      if(page_out(0) < 0)
+        break;
+    acquire(&ptable.lock);
+    sleep(kswapd, &ptable.lock);
+    release(&ptable.lock);
+  }
+}
+
+// Start kswapd as a kernel-only process.
+void
+kswapdinit(void)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kswapdinit");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kswapdinit: out of memory?");
+  p->context->eip = (uint)kswapd;
+  safestrcpy(p->name, "kswapd", sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
+void
+kswapdwake(void)
+{
+  wakeup(kswapd);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -465,67 +728,185 @@ procdump(void)
   }
 }
 
-// --------------------------------------------------------------------------
+// Fill ps[0..n-1] with the paging statistics of
+// the processes in use.  Returns how many it filled.
+// ps is in user memory, where a write may fault and the
+// fault may sleep or take ptable.lock, so each entry is
+// gathered in st under the lock and copied out after.
+int
+getpstat(struct pstat *ps, int n)
+{
+  struct proc *p;
+  struct pstat st;
+  int i;
+
+  i = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++){
+    acquire(&ptable.lock);
+    if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE){
+      release(&ptable.lock);
+      continue;
+    }
+    st.pid = p->pid;
+    safestrcpy(st.name, p->name, sizeof(st.name));
+    st.sz = p->sz;
+    st.rss = procrss(p);
+    st.minflt = p->minflt;
+    st.majflt = p->majflt;
+    st.nswapin = p->nswapin;
+    st.nswapout = p->nswapout;
+    release(&ptable.lock);
+    memmove(&ps[i], &st, sizeof(st));
+    i++;
+  }
+  return i;
+}
+
+//PAGEBREAK: 30
+// Address space locking.
+//
+// A process changes its own page table in the fault handler,
+// fork, exec, sbrk and the mmap calls, and may sleep there on
+// disk I/O.  Reclaim changes other processes' page tables.  Two
+// rules keep them apart without a lock that faults would have
+// to queue on:
+//
+// 1. A process brackets changes to its own address space with
+//    vmlock() and vmunlock(), and reclaim skips it meanwhile.
+// 2. Reclaim takes pages only from processes that are not
+//    running, and marks them (p->reclaimer) so the scheduler
+//    will not run them until reclaim_release().  No other CPU
+//    can be using a stale TLB entry for a page reclaim unmaps,
+//    and switchuvm flushes the TLB before the process runs again.
+//
+// A process only runs when no one reclaims from it, so vmlock
+// never has to wait.  p->vmbusy is guarded by a spinlock of
+// p's own, ptable.vm[], so that faults in different processes
+// do not contend with each other or with the scheduler.
+// ptable.lock covers p->state and p->reclaimer, which reclaim
+// checks and sets together.  Take ptable.lock first.
+
+static struct spinlock*
+vmlk(struct proc *p)
+{
+  return &ptable.vm[p - ptable.proc];
+}
 
 void
-init_swap_map(struct va_swap_map* vsm)
+vmlock(void)
 {
-  vsm->size = 0;
+  acquire(vmlk(proc));
+  if(proc->vmbusy || proc->reclaimer)
+    panic("vmlock");
+  proc->vmbusy = 1;
+  release(vmlk(proc));
 }
 
+// Since this takes the vm lock, anyone who was walking the
+// old page table in procrss() is done by the time it returns.
 void
-swap_map_add(struct va_swap_map* vsm, uint va)
+vmunlock(void)
 {
-  vsm->vaddrs[vsm->size++] = PGROUNDDOWN(va); 
+  acquire(vmlk(proc));
+  proc->vmbusy = 0;
+  release(vmlk(proc));
 }
 
-int
-swap_map_check(struct va_swap_map* vsm, uint va)
+static int
+vmbusy(struct proc *p)
 {
-  // va must be page-aligned
-  int index;
-  for (index = 0; index < vsm->size; index++) {
-    if (va == vsm->vaddrs[index]) {
-      return index;
-    }
-  }
-  return -1;
+  int busy;
+
+  acquire(vmlk(p));
+  busy = p->vmbusy;
+  release(vmlk(p));
+  return busy;
 }
 
-void
-init_vaddr_queue(struct vaddr_queue* vaq)
+// Count p's resident pages.  Its page table may be changing
+// under us, but exec cannot free it while we hold p's vm lock
+// (see vmunlock), nor can wait() while we hold ptable.lock,
+// which the caller does.
+static uint
+procrss(struct proc *p)
 {
-  //initlock(&vaq->lock, "vaq");
-  vaq->size = 0;
+  uint n;
+
+  acquire(vmlk(p));
+  n = residentuvm(p->pgdir, p->sz);
+  release(vmlk(p));
+  return n;
 }
 
+// Let the processes that page_out() took pages from run again.
 void
-vaddr_queue_enq(struct vaddr_queue* vaq, uint va)
+reclaim_release(void)
 {
-  if (vaq->size == 1024) {
-    return;
-  }
-  //acquire(&vaq->lock);
-  vaq->vaddrs[vaq->size] = va;
-  vaq->size++;
-  //release(&vaq->lock);
-  return;
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->reclaimer == proc)
+      p->reclaimer = 0;
+  release(&ptable.lock);
 }
 
-uint
-vaddr_queue_deq(struct vaddr_queue* vaq)
+// Choose a page to reclaim from any address space, or only
+// from process from if it is not 0.  The global hand visits
+// processes in ptable order and asks the replacement policy for
+// a victim in each one it passes, moving on whenever a page
+// earns a second chance, so victims are picked by recency across
+// the whole system rather than out of the faulting process's own
+// working set.  Processes that are running elsewhere or changing
+// their address space are passed over.  So is the caller, unless
+// it holds its own vmlock, as the fault handler and rsstrim() do:
+// a caller that does not, such as iget(), could otherwise sleep
+// writing out its own pages with nothing to stop another
+// reclaimer from choosing them again.  Returns the owner,
+// held for the caller until reclaim_release(), and sets *va, or
+// returns 0 if no process has an evictable page.
+struct proc*
+reclaim_victim(struct proc *from, uint *va)
 {
-  uint va;
-  int i;
-  if (vaq->size == 0) {
-    return -1;
-  }
-  va = vaq->vaddrs[0];
-  //acquire(&vaq->lock);
-  for (i = 1; i < vaq->size; i++) {
-    vaq->vaddrs[i-1] = vaq->vaddrs[i];
+  struct proc *p;
+  int idle, r;
+
+  acquire(&ptable.lock);
+  for(idle = 0; idle < NPROC; ){
+    p = from ? from : &ptable.proc[reclaimhand];
+    if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE ||
+       (p == proc && !p->vmbusy) ||
+       (p != proc && (p->state == RUNNING || vmbusy(p) ||
+                      (p->reclaimer && p->reclaimer != proc))) ||
+       (r = pgvictim(p, va)) < 0){
+      if(from)
+        break;
+      reclaimhand = (reclaimhand + 1) % NPROC;
+      idle++;
+      continue;
+    }
+    idle = 0;
+    if(r > 0){
+      // Stay on p: its next victims are at neighbouring
+      // addresses, which page_out() clusters in swap.
+      if(p != proc)
+        p->reclaimer = proc;
+      release(&ptable.lock);
+      return p;
+    }
+    if(!from)
+      reclaimhand = (reclaimhand + 1) % NPROC;
   }
-  vaq->size--;
-  //release(&vaq->lock);
-  return va;
-}
\ No newline at end of file
+  release(&ptable.lock);
+  return 0;
+}
+
+// Evict pages of the current process until it is back within
+// its resident set limit, if it has one.
+void
+rsstrim(void)
+{
+  while(proc->rsslimit && residentuvm(proc->pgdir, proc->sz) > proc->rsslimit)
+    if(page_out(proc) < 0)
+      break;
+}
@@ -52,16 +52,24 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-struct vaddr_queue {
-  uint vaddrs[1024];
-  //uint refer[1024];
-  //struct spinlock lock;
-  int size;
+// Loadable segment of the executable, recorded by exec()
+// so that page faults find a page's backing without
+// reading the ELF headers again.
+struct seg {
+  uint vaddr;                  // First address (page-aligned)
+  uint off;                    // File offset of vaddr
+  uint filesz;                 // Bytes backed by the file
+  uint memsz;                  // Bytes in memory; the rest are zero
+  uint flags;                  // ELF_PROG_FLAG_*
 };
 
-struct va_swap_map {
-  uint vaddrs[1024];
-  int size;
+// A region created by mmap, filled on demand like a segment.
+struct mmap {
+  uint addr;                   // First address (page-aligned)
+  uint len;                    // Length (page-aligned); 0 if unused
+  struct inode *ip;            // File mapped, or 0 if anonymous
+  uint off;                    // File offset of addr
+  int prot;                    // PROT_READ, PROT_WRITE
 };
 
 // Per-process state
@@ -79,10 +87,19 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  struct inode *ipgswp;        // For demand paging
-  struct inode *ipgswp2;
-  struct vaddr_queue vaq;      // For demand paging
-  struct va_swap_map vsm;      // For demand paging
+  struct inode *ipgswp2;       // Executable, for demand paging
+  struct seg seg[MAXSEG];      // Its loadable segments
+  int nseg;                    // Number of entries in seg
+  struct mmap mmap[NMMAP];     // Regions created by mmap
+  uint clockhand;              // Next user address the policy's hand examines
+  uint clockidle;              // Distance the hand has moved since a present page
+  int vmbusy;                  // Changing its own address space (vmlock)
+  struct proc *reclaimer;      // Process taking pages from this one, or 0
+  uint rsslimit;               // Most resident pages, or 0 for no limit
+  uint minflt;                 // Faults served without disk I/O
+  uint majflt;                 // Faults that read from disk
+  uint nswapin;                // Pages read back from swap
+  uint nswapout;               // Pages written to swap
 };
 
 // Process memory is laid out contiguously, low addresses first:
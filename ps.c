@@ -0,0 +1,64 @@
+// List processes with their memory use and paging activity.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+struct pstat ps[NPROC];
+
+// Print s left-justified in a field of width w.
+void
+field(char *s, int w)
+{
+  int n;
+
+  printf(1, "%s", s);
+  for(n = strlen(s); n < w; n++)
+    printf(1, " ");
+}
+
+// Print x right-justified in a field of width w.
+void
+num(uint x, int w)
+{
+  char buf[16];
+  int i;
+
+  i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    buf[--i] = '0' + x % 10;
+    x /= 10;
+  } while(x != 0 && i > 0);
+  for(w -= sizeof(buf) - 1 - i; w > 0; w--)
+    printf(1, " ");
+  printf(1, "%s", buf + i);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  n = getpstat(ps, NPROC);
+  if(n < 0){
+    printf(2, "ps: getpstat failed\n");
+    exit();
+  }
+  printf(1, "  PID NAME             SZ(K)  RSS MINFLT MAJFLT SWPIN SWPOUT\n");
+  for(i = 0; i < n; i++){
+    num(ps[i].pid, 5);
+    printf(1, " ");
+    field(ps[i].name, 16);
+    num(ps[i].sz/1024, 6);
+    num(ps[i].rss, 5);
+    num(ps[i].minflt, 7);
+    num(ps[i].majflt, 7);
+    num(ps[i].nswapin, 6);
+    num(ps[i].nswapout, 7);
+    printf(1, "\n");
+  }
+  exit();
+}
@@ -0,0 +1,16 @@
+// Paging statistics of a process, as returned by getpstat().
+struct pstat {
+  int pid;
+  char name[16];
+  uint sz;       // Size of process memory (bytes)
+  uint rss;      // Resident pages
+  uint minflt;   // Faults served without disk I/O
+  uint majflt;   // Faults that read from disk
+  uint nswapin;  // Pages read back from swap
+  uint nswapout; // Pages written to swap
+};
+
+// Page replacement policies, for pgpolicy().
+#define PGP_FIFO    0
+#define PGP_CLOCK   1
+#define PGP_WSCLOCK 2
@@ -0,0 +1,139 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of a single size, carved out of
+// whole pages (slabs) taken from kalloc().  Each slab starts with
+// a struct slab, followed by as many objects as fit in the rest
+// of the page; its free objects are chained through their first
+// word.  A cache keeps the slabs that have free objects on a
+// list and returns a slab to kalloc() once none of its objects
+// is in use, so the tables kept in a cache grow and shrink with
+// demand instead of being sized at compile time.
+//
+// kmem_cache_free() finds an object's slab by rounding its
+// address down to the page, so full slabs need not be on any
+// list.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+struct slab {
+  struct slab *next;     // on the cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  char *free;            // chain of free objects
+  int inuse;             // objects handed out
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;             // object size, a multiple of 4 bytes
+  int perslab;           // objects in a slab
+  struct slab *partial;  // slabs with free objects
+};
+
+static struct kmem_cache caches[NSLABCACHE];
+static int ncache;
+
+// Create a cache of objects of size bytes.  Called while the
+// kernel starts up, before there is any concurrency.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 3) & ~3;
+  if(size < sizeof(char*))
+    size = sizeof(char*);
+  if(ncache == NSLABCACHE || sizeof(struct slab) + size > PGSIZE)
+    panic("kmem_cache_create");
+  c = &caches[ncache++];
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->partial = 0;
+  return c;
+}
+
+static void
+unlinkslab(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+pushslab(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+// Allocate a zeroed object from cache c.
+// Returns 0 if there is no memory for a new slab.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  acquire(&c->lock);
+  if((s = c->partial) == 0){
+    if((s = (struct slab*)kalloc()) == 0){
+      release(&c->lock);
+      return 0;
+    }
+    s->cache = c;
+    s->inuse = 0;
+    s->free = 0;
+    obj = (char*)(s + 1);
+    for(i = 0; i < c->perslab; i++, obj += c->size){
+      *(char**)obj = s->free;
+      s->free = obj;
+    }
+    pushslab(c, s);
+  }
+  obj = s->free;
+  s->free = *(char**)obj;
+  if(++s->inuse == c->perslab)
+    unlinkslab(c, s);
+  release(&c->lock);
+  memset(obj, 0, c->size);
+  return obj;
+}
+
+// Return obj to cache c.  A slab left with no objects in use
+// goes back to kalloc(), unless it is the only one with free
+// objects: keeping it saves a kalloc() and kfree() for each
+// object when a single object is allocated and freed over and over.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != c)
+    panic("kmem_cache_free");
+  acquire(&c->lock);
+  *(char**)obj = s->free;
+  s->free = obj;
+  if(s->inuse-- == c->perslab)
+    pushslab(c, s);
+  if(s->inuse == 0 && (s->prev || s->next)){
+    unlinkslab(c, s);
+    kfree((char*)s);
+  }
+  release(&c->lock);
+}
@@ -0,0 +1,136 @@
+// Swap space.
+//
+// mkfs reserves sb.nswap page-sized slots on the disk right
+// after the file system.  Each slot has a reference count kept
+// in memory: fork shares swapped-out pages between parent and
+// child, and a slot is free once no page table entry or frame
+// refers to it.  Swap contents do not survive a reboot, so
+// nothing about the allocator lives on disk.
+//
+// Pages move between memory and their slots directly through
+// iderw(), up to SWAPCLUSTER pages per transfer, without going
+// through an inode, the log, or the buffer cache: swap blocks
+// are never cached, so a private struct buf cannot alias a
+// cached copy.
+//
+// Slots from NSWAPSLOT up live in the compressed pool in
+// memory instead (see zswap.c).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+
+struct {
+  struct spinlock lock;
+  int dev;
+  uint start;             // first block of the swap area
+  uint nslot;             // number of usable slots
+  uchar ref[NSWAPSLOT];   // references to each slot; 0 if free
+} swap;
+
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap;
+  if(swap.nslot > NSWAPSLOT)
+    swap.nslot = NSWAPSLOT;
+}
+
+// Allocate n consecutive swap slots and return the first.
+// Returns -1 if there is no free run that long.
+int
+swapalloc(int n)
+{
+  int s, i;
+
+  acquire(&swap.lock);
+  for(s = 0; s + n <= swap.nslot; s++){
+    for(i = 0; i < n; i++)
+      if(swap.ref[s+i])
+        break;
+    if(i == n){
+      for(i = 0; i < n; i++)
+        swap.ref[s+i] = 1;
+      release(&swap.lock);
+      return s;
+    }
+    s += i;
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Take another reference to swap slot s.
+void
+swapdup(int s)
+{
+  if(s >= NSWAPSLOT){
+    zswapdup(s);
+    return;
+  }
+  if(s < 0 || s >= swap.nslot)
+    panic("swapdup");
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0 || swap.ref[s] == 255)
+    panic("swapdup: ref");
+  swap.ref[s]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to swap slot s, freeing it with the last.
+void
+swapfree(int s)
+{
+  if(s >= NSWAPSLOT){
+    zswapfree(s);
+    return;
+  }
+  if(s < 0 || s >= swap.nslot)
+    panic("swapfree");
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0)
+    panic("swapfree: free slot");
+  swap.ref[s]--;
+  release(&swap.lock);
+}
+
+// Move n pages between memory and slots s..s+n-1 in a single
+// multi-sector disk transfer.
+static void
+swaprw(int s, char **pages, int n, int write)
+{
+  struct buf b;
+
+  if(s < 0 || n < 1 || n > SWAPCLUSTER || s + n > swap.nslot)
+    panic("swaprw");
+  memset(&b, 0, sizeof(b));
+  b.dev = swap.dev;
+  b.blockno = swap.start + s*SLOTBLOCKS;
+  b.pages = (uchar**)pages;
+  b.npage = n;
+  b.flags = write ? B_BUSY|B_DIRTY : B_BUSY;
+  iderw(&b);
+}
+
+// Write pages[0..n-1] to slots s..s+n-1.
+void
+swapwrite(int s, char **pages, int n)
+{
+  swaprw(s, pages, n, 1);
+}
+
+// Read slots s..s+n-1 into pages[0..n-1].
+void
+swapread(int s, char **pages, int n)
+{
+  swaprw(s, pages, n, 0);
+}
@@ -79,19 +79,26 @@ argstr(int n, char **pp)
 
 extern int sys_chdir(void);
 extern int sys_close(void);
+extern int sys_cowfork(void);
 extern int sys_dup(void);
 extern int sys_exec(void);
 extern int sys_exit(void);
 extern int sys_fork(void);
 extern int sys_fstat(void);
 extern int sys_getpid(void);
+extern int sys_getpstat(void);
 extern int sys_kill(void);
 extern int sys_link(void);
+extern int sys_madvise(void);
 extern int sys_mkdir(void);
 extern int sys_mknod(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
 extern int sys_open(void);
+extern int sys_pgpolicy(void);
 extern int sys_pipe(void);
 extern int sys_read(void);
+extern int sys_rsslimit(void);
 extern int sys_sbrk(void);
 extern int sys_sleep(void);
 extern int sys_unlink(void);
@@ -121,6 +128,13 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_getpstat] sys_getpstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_madvise] sys_madvise,
+[SYS_pgpolicy] sys_pgpolicy,
+[SYS_rsslimit] sys_rsslimit,
+[SYS_cowfork] sys_cowfork,
 };
 
 void
@@ -20,3 +20,10 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_getpstat 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_madvise 25
+#define SYS_pgpolicy 26
+#define SYS_rsslimit 27
+#define SYS_cowfork 28
@@ -235,7 +235,7 @@ bad:
   return -1;
 }
 
-struct inode*
+static struct inode*
 create(char *path, short type, short major, short minor)
 {
   uint off;
@@ -440,3 +440,35 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int addr, len, prot, flags, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  // Only private mappings: writes are never carried back to a file.
+  if(len <= 0 || off < 0 || flags != (flags & (MAP_PRIVATE|MAP_ANONYMOUS)) ||
+     !(flags & MAP_PRIVATE))
+    return -1;
+  if(flags & MAP_ANONYMOUS)
+    return mmap(0, len, 0, prot);
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE || !f->readable || f->ip->type != T_FILE)
+    return -1;
+  return mmap(f->ip, len, off, prot);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "pstat.h"
+#include "fcntl.h"
 
 int
 sys_fork(void)
@@ -36,6 +38,17 @@ sys_kill(void)
   return kill(pid);
 }
 
+int
+sys_getpstat(void)
+{
+  struct pstat *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || argptr(0, (char**)&ps, n*sizeof(*ps)) < 0)
+    return -1;
+  return getpstat(ps, n);
+}
+
 int
 sys_getpid(void)
 {
@@ -51,12 +64,73 @@ sys_sbrk(void)
   if(argint(0, &n) < 0)
     return -1;
   addr = proc->sz;
-  proc->sz += n;
-  //if(growproc(n) < 0)
-  //  return -1;
+  if(growproc(n) < 0)
+    return -1;
   return addr;
 }
 
+int
+sys_madvise(void)
+{
+  int addr, len, advice;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  if(len < 0)
+    return -1;
+  switch(advice){
+  case MADV_NORMAL:
+    return 0;
+  case MADV_DONTNEED:
+    return madvise_dontneed(addr, len);
+  }
+  return -1;
+}
+
+int
+sys_pgpolicy(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return pgpolicy(n);
+}
+
+// Make fork copy-on-write if n is 1, or have it copy every
+// resident page at once if n is 0.  Returns the old setting;
+// if n is negative, only reports it.
+int
+sys_cowfork(void)
+{
+  int n, old;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  old = cowfork;
+  if(n >= 0)
+    cowfork = n != 0;
+  return old;
+}
+
+// Limit the current process to n resident pages, or lift the
+// limit if n is 0.  Children inherit the limit.  Returns the
+// old limit.
+int
+sys_rsslimit(void)
+{
+  int n, old;
+
+  if(argint(0, &n) < 0 || n < 0)
+    return -1;
+  old = proc->rsslimit;
+  proc->rsslimit = n;
+  vmlock();
+  rsstrim();
+  vmunlock();
+  return old;
+}
+
 int
 sys_sleep(void)
 {
@@ -8,13 +8,9 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "elf.h"
+#include "fcntl.h"
 
 int mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm);
-void swap_map_add(struct va_swap_map* vsm, uint va);
-int swap_map_check(struct va_swap_map* vsm, uint va);
-void init_vaddr_queue(struct vaddr_queue* vaq);
-void vaddr_queue_enq(struct vaddr_queue* vaq, uint va);
-uint vaddr_queue_deq(struct vaddr_queue* vaq);
 pte_t *walkpgdir(pde_t *pgdir, const void *va, int alloc);
 
 // Interrupt descriptor table (shared by all CPUs).
@@ -22,8 +18,14 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
-void page_fault_handler(void);
-void page_out(void);
+int page_fault_handler(struct trapframe *tf);
+static int fault(uint va, uint err);
+static int mapsegpage(struct seg *sg, uint va, int perm);
+static void fault_around(struct seg *sg, uint va, int perm);
+static int swap_in(uint va, char *mem, int perm);
+static int cow_fault(uint va, uint err);
+static int reclaim(int *tries, uint err);
+static void mapuser(uint va, char *mem, int perm);
 
 void
 tvinit(void)
@@ -92,9 +94,14 @@ trap(struct trapframe *tf)
   
   // for lazy page allocation
   case T_PGFLT:
-    page_fault_handler();
-    break;
-
+    // Bringing a page in may sleep.  Kernel code copies user
+    // memory through a buffer rather than holding a spinlock
+    // while it might fault (see pipewrite).
+    if((tf->cs&3) == 0 && cpu->ncli > 0)
+      panic("page fault with a spinlock held");
+    if(page_fault_handler(tf) == 0)
+      break;
+    // not a demand-paging fault
 
   //PAGEBREAK: 13
   default:
@@ -128,103 +135,481 @@ trap(struct trapframe *tf)
     exit();
 }
 
-void 
-page_fault_handler(void)
-{
-  // For lazy page allocation
-  // if is heap or is stack
-  // stack if equal, heap otherwise
-  uint val, val2;
-  if (((uint)(val = rcr2())) >= ((uint)(val2 = proc->tf->esp))) {
-    //int i;
-    //cprintf("heap is faulting at %d %d\n", val, val2);
-    //cprintf("contents of swap map: ");
-    //for (i = 0; i < proc->vsm.size; i++) {
-    //  cprintf("0x%x", proc->vsm.vaddrs[i]);
-    //}
-    //cprintf("contents of vaddr queue: ");
-    //for (i = 0; i < proc->vaq.size; i++) {
-      //cprintf("0x%x", proc->vaq.vaddrs[i]);
-    //}
-    char *new_mem;
-    uint old_adr;
-    old_adr = PGROUNDDOWN(rcr2());
-    while((new_mem = kalloc()) == 0)
-    {
-      cprintf("system out of memory\n");
-      page_out();
-    }
-    int ind;
-    vaddr_queue_enq(&proc->vaq, rcr2());
-    memset(new_mem, 0, PGSIZE);
-    mappages(proc->pgdir, (char*)old_adr, PGSIZE, v2p(new_mem), PTE_W|PTE_U);
+// Return the segment of p's executable that contains va, or 0.
+static struct seg*
+findseg(struct proc *p, uint va)
+{
+  struct seg *sg;
 
-    if ((ind = swap_map_check(&proc->vsm, old_adr)) == -1) { // heap is new
-      swap_map_add(&proc->vsm, rcr2());
-    }
-    else { // heap page exists
-      loaduvm(proc->pgdir, (char*)old_adr, proc->ipgswp, ind * PGSIZE, PGSIZE);
-    }
+  for(sg = p->seg; sg < &p->seg[p->nseg]; sg++)
+    if(va >= sg->vaddr && va < sg->vaddr + sg->memsz)
+      return sg;
+  return 0;
+}
+
+// Return the mmap region of p that contains va, or 0.
+static struct mmap*
+findmmap(struct proc *p, uint va)
+{
+  struct mmap *mm;
+
+  for(mm = p->mmap; mm < &p->mmap[NMMAP]; mm++)
+    if(mm->len && va >= mm->addr && va < mm->addr + mm->len)
+      return mm;
+  return 0;
+}
+
+// The permissions a private page at va is mapped with:
+// writable unless it lies in a read-only segment or mapping.
+static int
+pageperm(uint va)
+{
+  struct seg *sg;
+  struct mmap *mm;
+
+  if((sg = findseg(proc, va)) != 0)
+    return PTE_U | ((sg->flags & ELF_PROG_FLAG_WRITE) ? PTE_W : 0);
+  if((mm = findmmap(proc, va)) != 0)
+    return PTE_U | ((mm->prot & PROT_WRITE) ? PTE_W : 0);
+  return PTE_U | PTE_W;
+}
+
+// Read the file-backed part of page va of segment sg into mem,
+// which the caller has zeroed; bss stays zero.  The caller
+// holds the executable's inode lock.
+static void
+loadsegpage(struct seg *sg, uint va, char *mem)
+{
+  uint end, n;
+
+  end = sg->vaddr + sg->filesz;
+  if(va >= end)
+    return;
+  n = end - va < PGSIZE ? end - va : PGSIZE;
+  readi(proc->ipgswp2, mem, sg->off + va - sg->vaddr, n);
+}
+
+// Bring in the page at the faulting address: from its swap
+// slot if it was paged out, from the executable if it lies in
+// a loadable segment, from the file if it lies in a file
+// mapping, or zero-filled if it is heap, stack or anonymous.
+// A write to a shared copy-on-write page copies it.
+// Returns -1 if the fault is not one demand paging can satisfy.
+int
+page_fault_handler(struct trapframe *tf)
+{
+  uint addr;
+  int r;
+
+  // Read %cr2 before anything here can sleep and let
+  // another fault on this CPU overwrite it.
+  addr = rcr2();
+  if(proc == 0 || addr >= proc->sz)
+    return -1;
+  vmlock();
+  r = fault(PGROUNDDOWN(addr), tf->err);
+  if(r == 0)
+    rsstrim();
+  vmunlock();
+  return r;
+}
+
+// Handle a fault at page va with error code err,
+// holding the address space lock.
+static int
+fault(uint va, uint err)
+{
+  pte_t *pte;
+  struct seg *sg;
+  struct mmap *mm;
+  char *mem;
+  int perm, r, tries, locked;
+
+  pgfault(proc, va);
+  pte = walkpgdir(proc->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    if((err & FEC_WR) && (*pte & PTE_COW))
+      return cow_fault(va, err);
+    return -1;
   }
-  // page fault is from code data segment
-  // read from disk, page it in
-  else {
-    //int i;
-    uint old_adr;
-    char *new_mem;
-    //cprintf("text data segment is faulting!\n");
-    //cprintf("contents of swap map: ");
-    //for (i = 0; i < proc->vsm.size; i++) {
-    //  cprintf("0x%x", proc->vsm.vaddrs[i]);
-    //}
-    //cprintf("contents of vaddr queue: ");
-    //for (i = 0; i < proc->vaq.size; i++) {
-    //  cprintf("0x%x", proc->vaq.vaddrs[i]);
-    //}
-    old_adr = PGROUNDDOWN(rcr2());
-    //cprintf("at 0x%x\n", rcr2());
-    
-    //allocuvm(pgdir, sz, ph.vaddr + ph.memsz);
-    int ind = swap_map_check(&proc->vsm, old_adr);
-    while((new_mem = kalloc()) == 0)
-    {
-      cprintf("system out of memory\n");
-      // IMPLEMENT PAGING OUT HERE
-      // PAGE REPLACEMENT ALGO
-      //deallocuvm(pgdir, newsz, oldsz); TODO: Implement this
-      page_out();
-    }
-    vaddr_queue_enq(&proc->vaq, rcr2());
-    memset(new_mem, 0, PGSIZE);
-    mappages(proc->pgdir, (char*)old_adr, PGSIZE, v2p(new_mem), PTE_W|PTE_U);
-    if ((ind = swap_map_check(&proc->vsm, old_adr)) == -1) { // code data is new
-      swap_map_add(&proc->vsm, rcr2());
-      struct elfhdr elf;
-      struct proghdr ph;
-      readi(proc->ipgswp2, (char*)&elf, 0, sizeof(elf));
-      readi(proc->ipgswp2, (char*)&ph, elf.phoff, sizeof(ph));
-      loaduvm(proc->pgdir, (char*)old_adr, proc->ipgswp2, ph.off + old_adr, PGSIZE);
-    }
-    else { // code page exists
-      loaduvm(proc->pgdir, (char*)old_adr, proc->ipgswp, ind * PGSIZE, PGSIZE);
-    }
-    //loaduvm(proc->pgdir, (char*)old_adr, proc->ipgswp, ind * PGSIZE, PGSIZE);
+  // Make sure there is a page table to map the page in.
+  tries = 0;
+  while(pte == 0 && (pte = walkpgdir(proc->pgdir, (char*)va, 1)) == 0)
+    if(reclaim(&tries, err) < 0)
+      return -1;
+  sg = findseg(proc, va);
+  mm = sg ? 0 : findmmap(proc, va);
+  perm = pageperm(va);
+
+  if(!(pte && (*pte & PTE_SWAP)) && !(err & FEC_WR) &&
+     (sg == 0 || va >= sg->vaddr + sg->filesz) && (mm == 0 || mm->ip == 0)){
+    // First touch of a zero-fill page is a read:
+    // share the zero page until it is written.
+    krefinc(zeropage);
+    if(perm & PTE_W)
+      perm = (perm & ~PTE_W) | PTE_COW;
+    mapuser(va, zeropage, perm|PTE_A);
+    proc->minflt++;
+    return 0;
   }
+
+  // kswapd normally keeps frames free; reclaim
+  // synchronously only if it has fallen behind.
+  if(sg && !(pte && (*pte & PTE_SWAP))){
+    // code data is new: take it from the page cache
+    // or read it from the executable
+    while((r = mapsegpage(sg, va, perm|PTE_A)) < 0)
+      if(reclaim(&tries, err) < 0)
+        return -1;
+    if(r)
+      proc->majflt++;
+    else
+      proc->minflt++;
+    fault_around(sg, va, perm);
+    return 0;
+  }
+  if(pte && (*pte & PTE_SWAP)){ // page was swapped out
+    // swap_in fills the whole page
+    while((mem = kalloc()) == 0)
+      if(reclaim(&tries, err) < 0)
+        return -1;
+    if(swap_in(va, mem, perm))
+      proc->majflt++;
+    else
+      proc->minflt++;
+    return 0;
+  }
+  while((mem = kalloc_zeroed()) == 0)
+    if(reclaim(&tries, err) < 0)
+      return -1;
+  if(mm && mm->ip){
+    // Past the end of the file the page stays zero.
+    locked = ilockfault(mm->ip);
+    readi(mm->ip, mem, mm->off + va - mm->addr, PGSIZE);
+    if(locked)
+      iunlock(mm->ip);
+    mapuser(va, mem, perm|PTE_A);
+    proc->majflt++;
+    return 0;
+  }
+  // heap, stack and anonymous pages start out zeroed
+
+  // Map the page only once it is filled, so reclaim cannot
+  // choose it while a read above sleeps.  Setting PTE_A stands
+  // in for the access that faulted.
+  mapuser(va, mem, perm|PTE_A);
+  proc->minflt++;
+  return 0;
 }
 
-void 
-page_out(void)
+// Map page va of segment sg from the page cache, if it lies
+// wholly within the file and is cached there.  It is mapped
+// read-only, and marked PTE_COW if the segment is writable so
+// that the first write gives the process its own copy.
+// Returns 1 if the page was mapped, 0 if not.
+static int
+mapcached(struct seg *sg, uint va, int perm)
 {
+  char *mem;
+
+  if(va + PGSIZE > sg->vaddr + sg->filesz)
+    return 0;
+  if((mem = pcacheget(proc->ipgswp2, sg->off + va - sg->vaddr)) == 0)
+    return 0;
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  mapuser(va, mem, perm);
+  return 1;
+}
+
+// Map page va of segment sg.  A page that lies wholly within
+// the file is shared through the page cache (see mapcached),
+// and entered there if it has to be read.  A page that reaches
+// into bss is read into a private frame.
+// Returns 1 if the page was read from the executable, 0 if it
+// was found in the cache, or -1 if there is no memory for it.
+static int
+mapsegpage(struct seg *sg, uint va, int perm)
+{
+  struct inode *ip;
+  char *mem;
+  int shared, locked;
+
+  if(mapcached(sg, va, perm))
+    return 0;
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  // Keep the inode locked until the page is cached, so that
+  // writei() cannot drop the file's cached pages in between and
+  // leave this now stale one behind.  If this process is itself
+  // in writei() on the file, the page may be half written, and
+  // is not cached at all.
+  ip = proc->ipgswp2;
+  shared = va + PGSIZE <= sg->vaddr + sg->filesz;
+  locked = ilockfault(ip);
+  loadsegpage(sg, va, mem);
+  if(shared && locked)
+    pcacheput(ip, sg->off + va - sg->vaddr, mem);
+  if(locked)
+    iunlock(ip);
+  if(shared && (perm & PTE_W))
+    perm = (perm & ~PTE_W) | PTE_COW;
+  mapuser(va, mem, perm);
+  return 1;
+}
+
+// After a text or data fault at va, map up to FAULTAROUND
+// untouched pages that follow it in the same segment, if they
+// are in the page cache already, as they are once the binary
+// has run before.  Pages that are not cached are left to fault:
+// reading them here would cost a disk transfer apiece, with the
+// address space locked, for pages that may never be used.
+// They are mapped without PTE_A so the clock reclaims them first
+// if they are never used.  Stops at the end of the page table
+// that maps va.
+static void
+fault_around(struct seg *sg, uint va, int perm)
+{
+  uint a;
   pte_t *pte;
-  uint pa;
-  uint repl_va = PGROUNDDOWN(vaddr_queue_deq(&proc->vaq));
-  int ind = swap_map_check(&proc->vsm, repl_va);
-  writei(proc->ipgswp, (char*)repl_va, ind * PGSIZE, PGSIZE);
-  pte = walkpgdir(proc->pgdir, (char*)repl_va, 0);
-  pa = PTE_ADDR(*pte);
-  if(pa == 0)
-    panic("kfree");
-  char *v = p2v(pa);
-  kfree(v);
-  *pte = 0;
-}
\ No newline at end of file
+  int i;
+
+  for(i = 1; i <= FAULTAROUND; i++){
+    a = va + i*PGSIZE;
+    if(a >= proc->sz)
+      break;
+    pte = walkpgdir(proc->pgdir, (char*)a, 0);
+    if(pte == 0 || *pte != 0)
+      break;
+    if(!mapcached(sg, a, perm))
+      break;
+  }
+}
+
+// Handle a write to the copy-on-write page at va.  Copy it
+// into a private frame unless no one else refers to it any
+// more, in which case it simply becomes writable.
+static int
+cow_fault(uint va, uint err)
+{
+  pte_t *pte;
+  char *mem, *old;
+  int tries;
+
+  pte = walkpgdir(proc->pgdir, (char*)va, 0);
+  old = p2v(PTE_ADDR(*pte));
+  proc->minflt++;
+  if(krefcnt(old) == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W | PTE_A | PTE_D;
+    lcr3(v2p(proc->pgdir));
+    return 0;
+  }
+  tries = 0;
+  while((mem = kalloc()) == 0)
+    if(reclaim(&tries, err) < 0)
+      return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW)){
+    // Evicted while we reclaimed; fault again.
+    kfree(mem);
+    return 0;
+  }
+  old = p2v(PTE_ADDR(*pte));
+  memmove(mem, old, PGSIZE);
+  *pte = v2p(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W | PTE_A | PTE_D;
+  lcr3(v2p(proc->pgdir));
+  pgunmap(proc, va, old);
+  pgmap(proc, va, mem);
+  kfree(old);
+  return 0;
+}
+
+// Called when a fault finds no free frame.  Evicts pages, and
+// once OOMRETRY attempts in a row have left kalloc() empty
+// handed, kills the process with the largest resident set and
+// lets it run so that it can exit and free its memory.
+// Returns -1 if the faulting process has been killed and the
+// fault came from user space; a fault taken inside the kernel
+// cannot be abandoned, so it keeps waiting for memory and the
+// process exits on its way back to user space.  While it waits
+// it kills no one else (see oomkill).
+static int
+reclaim(int *tries, uint err)
+{
+  if(proc->killed && (err & FEC_U))
+    return -1;
+  if(++*tries < OOMRETRY){
+    page_out(0);
+    return 0;
+  }
+  *tries = 0;
+  if(!proc->killed)
+    oomkill();
+  if(proc->killed && (err & FEC_U))
+    return -1;
+  yield();
+  return 0;
+}
+
+// Map frame mem at va in the current process and tell the
+// replacement policy.
+static void
+mapuser(uint va, char *mem, int perm)
+{
+  mappages(proc->pgdir, (char*)va, PGSIZE, v2p(mem), perm);
+  pgmap(proc, va, mem);
+}
+
+// Read the swapped-out page at va into mem and map it.  Pages
+// that follow va and sit in the following swap slots were most
+// likely evicted in the same cluster; read up to SWAPCLUSTER of
+// them in the same transfer and map them too, without PTE_A.
+// Every page keeps its slot: until it is dirtied the slot is a
+// valid copy, and eviction need not write it again.
+// A page in the compressed pool is decompressed on its own and
+// gives up its entry, which would be cheap to make again.
+// Returns 1 if the disk was read, 0 if not.
+static int
+swap_in(uint va, char *mem, int perm)
+{
+  char *pages[SWAPCLUSTER];
+  pte_t *pte;
+  int slot, i, n;
+
+  pte = walkpgdir(proc->pgdir, (char*)va, 0);
+  slot = PTE_SLOT(*pte);
+  if(slot >= NSWAPSLOT){
+    zswapread(slot, mem);
+    proc->nswapin++;
+    *pte = 0;
+    mapuser(va, mem, perm|PTE_A|PTE_D);
+    swapfree(slot);
+    return 0;
+  }
+  pages[0] = mem;
+  for(n = 1; n < SWAPCLUSTER; n++){
+    if(va + n*PGSIZE >= proc->sz || kfreecount() < FREELO)
+      break;
+    pte = walkpgdir(proc->pgdir, (char*)(va + n*PGSIZE), 0);
+    if(pte == 0 || !(*pte & PTE_SWAP) || PTE_SLOT(*pte) != slot + n)
+      break;
+    if((pages[n] = kalloc()) == 0)
+      break;
+  }
+  swapread(slot, pages, n);
+  proc->nswapin += n;
+  for(i = 0; i < n; i++){
+    ksetslot(pages[i], slot + i);
+    pte = walkpgdir(proc->pgdir, (char*)(va + i*PGSIZE), 0);
+    *pte = 0;
+    // A neighbour may lie in another segment or mapping.
+    if(i == 0)
+      mapuser(va, pages[i], perm|PTE_A);
+    else
+      mapuser(va + i*PGSIZE, pages[i], pageperm(va + i*PGSIZE));
+  }
+  return 1;
+}
+
+// Evict up to SWAPCLUSTER pages chosen by the replacement
+// policy, from any process, or only from process from if it is
+// not 0.  A clean page costs no I/O: if it came from swap its slot still
+// holds it, and otherwise it is zero-fill or backed by a segment
+// of the executable and the next fault recreates it.  A dirty
+// page is compressed into the pool in memory if it fits; the
+// rest are given consecutive slots on disk and written together
+// in as few transfers as free swap allows.  Returns 0 if
+// anything was evicted, -1 if not.
+int
+page_out(struct proc *from)
+{
+  struct proc *p, *owners[SWAPCLUSTER];
+  pte_t *pte, *ptes[SWAPCLUSTER];
+  char *mem, *pages[SWAPCLUSTER];
+  uint va, vas[SWAPCLUSTER];
+  int i, n, nw, nclean, run, slot, slots[SWAPCLUSTER];
+
+  n = nclean = 0;
+  while(n + nclean < SWAPCLUSTER && (p = reclaim_victim(from, &va)) != 0){
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if(PTE_ADDR(*pte) == 0)
+      panic("page_out");
+    mem = p2v(PTE_ADDR(*pte));
+    if((*pte & PTE_D) && (slot = zswapstore(mem)) >= 0){
+      if(kgetslot(mem) >= 0)
+        swapfree(kgetslot(mem));
+      *pte = (slot << PGSHIFT) | PTE_SWAP;
+      p->nswapout++;
+      pgunmap(p, va, mem);
+      kfree(mem);
+      nclean++;
+      continue;
+    }
+    if(*pte & PTE_D){
+      // A small process can bring its hand back
+      // round to a page already gathered.
+      for(i = 0; i < n; i++)
+        if(ptes[i] == pte)
+          break;
+      if(i < n)
+        break;
+      ptes[n] = pte;
+      owners[n] = p;
+      vas[n] = va;
+      pages[n++] = mem;
+      continue;
+    }
+    slot = kgetslot(mem);
+    if(slot >= 0)
+      *pte = (slot << PGSHIFT) | PTE_SWAP;
+    else
+      *pte = 0;
+    pgunmap(p, va, mem);
+    kfree(mem);
+    nclean++;
+  }
+
+  // Write the dirty pages in runs of consecutive slots, one
+  // transfer per run: all of them in one if swap has room, or
+  // else in shorter runs, down to single slots, so that a
+  // fragmented swap area costs transfers but does not stop
+  // eviction.  Pages left without a slot stay resident.
+  // The dirty pages stay mapped until the write is done, so
+  // no page table entry names a slot the disk has not filled.
+  // The owners stay held meanwhile: if one ran, it could change
+  // a page being written, or exit and free a slot this write
+  // would then overwrite.
+  nw = 0;
+  run = n;
+  while(nw < n && run > 0){
+    if(run > n - nw)
+      run = n - nw;
+    if((slot = swapalloc(run)) < 0){
+      run /= 2;
+      continue;
+    }
+    swapwrite(slot, pages + nw, run);
+    for(i = 0; i < run; i++)
+      slots[nw + i] = slot + i;
+    nw += run;
+  }
+  for(i = 0; i < nw; i++){
+    if(kgetslot(pages[i]) >= 0)
+      swapfree(kgetslot(pages[i]));
+    *ptes[i] = (slots[i] << PGSHIFT) | PTE_SWAP;
+    owners[i]->nswapout++;
+    pgunmap(owners[i], vas[i], pages[i]);
+  }
+  if(nw + nclean == 0 && from == 0){
+    // Nothing mapped could go; fall back on
+    // cached executable pages no process uses.
+    nclean = pcacheshrink(SWAPCLUSTER);
+  }
+  // Drop stale translations along with any cached
+  // PTE_A bits the policy just cleared.
+  if(proc)
+    lcr3(v2p(proc->pgdir));
+  reclaim_release();
+  for(i = 0; i < nw; i++)
+    kfree(pages[i]);
+  return nw + nclean > 0 ? 0 : -1;
+}
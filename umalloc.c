@@ -21,12 +21,15 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+#define TRIM  (64*1024)  // give back a free heap top this large
+
+// Put block bp on the free list, merging it with its
+// neighbours.  Returns the block that now holds bp.
+static Header*
+addfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -35,12 +38,30 @@ free(void *ap)
     bp->s.ptr = p->s.ptr->s.ptr;
   } else
     bp->s.ptr = p->s.ptr;
+  freep = p;
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+    return p;
+  }
+  p->s.ptr = bp;
+  return bp;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+  uint keep;
+
+  bp = addfree((Header*)ap - 1);
+  // If the top of the heap is free and large, shrink the heap,
+  // keeping just the block's first page.
+  if((char*)(bp + bp->s.size) == sbrk(0) && bp->s.size*sizeof(Header) >= TRIM){
+    keep = (((uint)(bp + 1) + 4095) & ~4095) - (uint)bp;
+    if(sbrk(-(bp->s.size*sizeof(Header) - keep)) != (char*)-1)
+      bp->s.size = keep / sizeof(Header);
+  }
 }
 
 static Header*
@@ -56,77 +77,47 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  addfree(hp);
   return freep;
 }
 
+// Best fit: take the smallest free block that is large enough,
+// so big blocks stay whole for big requests.
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp; //*initp;
+  Header *p, *prevp, *bestp, *bestprevp;
   uint nunits;
-  uint best_fit = 0xffffffff;
-  Header *best_p, *best_prevp;
-  uint i;
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
   }
-  //initp = prevp->s.ptr;
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    //printf(1, "got called 1\n");
-    if(p->s.size >= nunits){
-      printf(1, "got called 4\n");
-      if(p->s.size == nunits) {
-        printf(1, "got called 2\n");
-        prevp->s.ptr = p->s.ptr;
-        //best_fit = p->s.size;
-        //best_p = p;
-        freep = prevp;
-        return (void *)(p + 1);
-        //return (void*)(p + 1);
+  for(;;){
+    bestp = bestprevp = 0;
+    for(prevp = freep, p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+      if(p->s.size >= nunits && (bestp == 0 || p->s.size < bestp->s.size)){
+        bestp = p;
+        bestprevp = prevp;
+        if(p->s.size == nunits)
+          break;
       }
+      if(p == freep)
+        break;
+    }
+    if(bestp){
+      if(bestp->s.size == nunits)
+        bestprevp->s.ptr = bestp->s.ptr;
       else {
-        if (p->s.size < best_fit) {
-          printf(1, "got called 3\n");
-          i++;
-          best_fit = p->s.size;
-          best_p = p;
-          best_prevp = prevp;
-          if (i == 10)
-            break;
-        }
-        //p->s.size -= nunits;
-        //p += p->s.size;
-        //p->s.size = nunits;
+        bestp->s.size -= nunits;
+        bestp += bestp->s.size;
+        bestp->s.size = nunits;
       }
-
-      //freep = prevp;
-      //return (void*)(p + 1);
+      freep = bestprevp;
+      return (void*)(bestp + 1);
     }
-    
-    if(p == prevp)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+    if(morecore(nunits) == 0)
+      return 0;
   }
-
-  best_prevp->s.ptr = best_p->s.ptr;
-  freep = best_prevp;
-  return (void *)(best_p);
-
-
-
-
-
-  // best_p->s.size -= nunits;
-  // best_p += best_p->s.size;
-  // best_p->s.size = nunits;
-  // best_prevp->s.ptr = best_p;
-  // freep = best_prevp;
-  
-  // return (void *)(best_p + 1);
-
-
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct pstat;
 
 // system calls
 int fork(void);
@@ -23,6 +24,13 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getpstat(struct pstat*, int);
+char* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int madvise(void*, int, int);
+int pgpolicy(int);
+int rsslimit(int);
+int cowfork(int);
 
 // ulib.c
 int stat(char*, struct stat*);
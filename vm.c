@@ -9,6 +9,7 @@
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+int cowfork = 1;  // 0: fork copies resident pages at once (see copyuvm)
 struct segdesc gdt[NSEGS];
 
 
@@ -53,10 +54,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)p2v(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table 
     // entries, if necessary.
@@ -105,13 +105,15 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP, 
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop, 
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found at
+// boot by kinit1) (directly addressable from end..P2V(phystop)).
+// The page tables for the kernel part are built once, for kpgdir,
+// and shared by every process's page directory.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -123,9 +125,10 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
+#define KMAPMEM 2     // the entry that ends at phystop
 
 // Set up kernel part of a page table.
 pde_t*
@@ -137,8 +140,14 @@ setupkvm(void)
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
   memset(pgdir, 0, PGSIZE);
-  if (p2v(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
+  if(kpgdir){
+    memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+            (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+    return pgdir;
+  }
+  if (p2v(phystop) > (void*)DEVSPACE)
+    panic("phystop too high");
+  kmap[KMAPMEM].phys_end = phystop;
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
     if(mappages(pgdir, k->virt, k->phys_end - k->phys_start, 
                 (uint)k->phys_start, k->perm) < 0)
@@ -190,7 +199,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
     panic("inituvm: more than a page");
   mem = kalloc();
   memset(mem, 0, PGSIZE);
-  mappages(pgdir, 0, PGSIZE, v2p(mem), PTE_W|PTE_U);
+  mappages(pgdir, 0, PGSIZE, v2p(mem), PTE_W|PTE_U|PTE_D);
   memmove(mem, init, sz);
 }
 
@@ -233,14 +242,15 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
-    mappages(pgdir, (char*)a, PGSIZE, v2p(mem), PTE_W|PTE_U);
+    // Filled through the kernel mapping (e.g. by exec's copyout),
+    // so the hardware will never set PTE_D for those writes.
+    mappages(pgdir, (char*)a, PGSIZE, v2p(mem), PTE_W|PTE_U|PTE_D);
   }
   return newsz;
 }
@@ -251,6 +261,15 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 // process size.  Returns the new process size.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  return unmapuvm(0, pgdir, oldsz, newsz);
+}
+
+// Like deallocuvm, for pages of pgdir that process p has had
+// mapped: the replacement policy hears of each present user page
+// before its frame is released.
+int
+unmapuvm(struct proc *p, pde_t *pgdir, uint oldsz, uint newsz)
 {
   pte_t *pte;
   uint a, pa;
@@ -268,8 +287,15 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if(pa == 0)
         panic("kfree");
       char *v = p2v(pa);
+      if(p && (*pte & PTE_U))
+        pgunmap(p, a, v);
+      if(kgetslot(v) >= 0)
+        swapfree(kgetslot(v));
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_SLOT(*pte));
+      *pte = 0;
     }
   }
   return newsz;
@@ -285,7 +311,8 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  // The kernel's page tables are shared; free only the user ones.
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = p2v(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -308,37 +335,97 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Frames are shared rather than copied:
+// writable pages turn read-only and PTE_COW in both, and the
+// first write to one copies it.  Swapped-out pages stay out,
+// sharing the parent's slot, and pages never touched are left
+// for the child to fault in, so the cost is in proportion to
+// the resident pages.  pgdir must be the current one.
+// If cowfork is 0, resident pages are copied straight away, as
+// fork used to, so that forkbench can compare the two.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  pte_t *pte, *npte;
+  uint pa, i;
+  char *v, *mem;
+  int flags;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      if((npte = walkpgdir(d, (void *) i, 1)) == 0)
+        goto bad;
+      swapdup(PTE_SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)p2v(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, v2p(mem), flags) < 0)
+    v = p2v(pa);
+    if(!cowfork){
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, v, PGSIZE);
+      // The copy has no swap slot or file page behind it.
+      flags = PTE_FLAGS(*pte) | PTE_D;
+      if(flags & PTE_COW)
+        flags = (flags & ~PTE_COW) | PTE_W;
+      if(mappages(d, (void*)i, PGSIZE, v2p(mem), flags) < 0){
+        kfree(mem);
+        goto bad;
+      }
+      continue;
+    }
+    if(kgetslot(v) >= 0){
+      // A retained swap slot stands in for one mapping only;
+      // the shared frame becomes the sole copy.
+      swapfree(kgetslot(v));
+      ksetslot(v, -1);
+      *pte |= PTE_D;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
       goto bad;
+    krefinc(v);
   }
+  // Drop translations that still allow writes.
+  lcr3(v2p(pgdir));
   return d;
 
 bad:
+  lcr3(v2p(pgdir));
   freevm(d);
   return 0;
 }
 
+// Count the present user pages below sz.
+uint
+residentuvm(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint a, n;
+
+  n = 0;
+  for(a = 0; a < sz; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U))
+      n++;
+  }
+  return n;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -0,0 +1,724 @@
+// Tests of the virtual memory system: page replacement,
+// copy-on-write, the zero page and mmap.  Kept apart from
+// usertests so that neither binary outgrows MAXFILE.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "pstat.h"
+
+char buf[8192];
+int stdout = 1;
+
+// This process's paging statistics.
+void
+mystat(struct pstat *st)
+{
+  static struct pstat ps[NPROC];
+  int i, n, pid;
+
+  pid = getpid();
+  n = getpstat(ps, NPROC);
+  for(i = 0; i < n; i++){
+    if(ps[i].pid == pid){
+      *st = ps[i];
+      return;
+    }
+  }
+  printf(stdout, "getpstat does not list this process\n");
+  exit();
+}
+
+// getpstat() into bss the process has never written: once
+// into a page that reads have mapped to the zero page, and once
+// into a page not mapped at all.  The kernel's writes fault like
+// the process's own would.
+char pstatbuf[5*4096];
+
+void
+pstattest(void)
+{
+  struct pstat *ps;
+  char *page;
+  int i, k, n, pid;
+
+  printf(stdout, "pstat test\n");
+  page = (char*)(((uint)pstatbuf + 4095) & ~4095);
+  pid = getpid();
+  for(k = 0; k < 2; k++){
+    ps = (struct pstat*)(page + k*2*4096);
+    if(k == 0 && *(char*)ps != 0){
+      printf(stdout, "pstat test bss not zero\n");
+      exit();
+    }
+    n = getpstat(ps, NPROC);
+    for(i = 0; i < n; i++)
+      if(ps[i].pid == pid)
+        break;
+    if(i == n){
+      printf(stdout, "pstat test: getpstat does not list this process\n");
+      exit();
+    }
+  }
+  printf(stdout, "pstat test OK\n");
+}
+
+// A small hot set touched between every page of a long cold
+// sweep, with the resident set capped at CLOCKRSS pages, far
+// fewer than the two together.  CLOCK should give the hot pages
+// a second chance, so that only cold pages are paged out and
+// faulted back in, while FIFO evicts the hot pages along with
+// them.  The sweep runs under each and the faults are reported.
+#define CLOCKHOT  32
+#define CLOCKCOLD 768
+#define CLOCKRSS  256
+
+// Sweep from scratch under policy pol.  Returns the faults
+// taken and sets *majflt to those that read from disk.
+uint
+clocksweep(char *hot, char *cold, int pol, uint *majflt)
+{
+  struct pstat st0, st1;
+  int i, j, pass;
+
+  madvise(hot, CLOCKHOT*4096, MADV_DONTNEED);
+  madvise(cold, CLOCKCOLD*4096, MADV_DONTNEED);
+  pgpolicy(pol);
+  mystat(&st0);
+  for(pass = 0; pass < 4; pass++){
+    for(i = 0; i < CLOCKCOLD; i++){
+      cold[i*4096] = i;
+      for(j = 0; j < CLOCKHOT; j++)
+        hot[j*4096]++;
+    }
+  }
+  mystat(&st1);
+
+  for(j = 0; j < CLOCKHOT; j++){
+    if(hot[j*4096] != (char)(4*CLOCKCOLD)){
+      printf(stdout, "clock test hot page %d corrupt\n", j);
+      exit();
+    }
+  }
+  for(i = 0; i < CLOCKCOLD; i++){
+    if(cold[i*4096] != (char)i){
+      printf(stdout, "clock test cold page %d corrupt\n", i);
+      exit();
+    }
+  }
+  *majflt = st1.majflt - st0.majflt;
+  return (st1.minflt + st1.majflt) - (st0.minflt + st0.majflt);
+}
+
+void
+clocktest(void)
+{
+  struct pstat st;
+  char *hot, *cold, *oldbrk;
+  uint fifo, fifomaj, clock, clockmaj;
+  int oldpol, oldlimit;
+
+  printf(stdout, "clock test\n");
+  oldbrk = sbrk(0);
+  if((uint)oldbrk % 4096)
+    sbrk(4096 - (uint)oldbrk % 4096);
+  hot = sbrk(CLOCKHOT*4096);
+  cold = sbrk(CLOCKCOLD*4096);
+  if(hot == (char*)0xffffffff || cold == (char*)0xffffffff){
+    printf(stdout, "clock test sbrk failed\n");
+    exit();
+  }
+
+  mystat(&st);
+  oldlimit = rsslimit(st.rss + CLOCKRSS);
+  oldpol = pgpolicy(-1);
+  fifo = clocksweep(hot, cold, PGP_FIFO, &fifomaj);
+  clock = clocksweep(hot, cold, PGP_CLOCK, &clockmaj);
+  pgpolicy(oldpol);
+  rsslimit(oldlimit);
+  sbrk(-(sbrk(0) - oldbrk));
+
+  printf(stdout, "clock test: fifo %d faults (%d major), "
+         "clock %d faults (%d major)\n", fifo, fifomaj, clock, clockmaj);
+  if(clock >= fifo){
+    printf(stdout, "clock test: clock did not beat fifo\n");
+    exit();
+  }
+  printf(stdout, "clock test OK\n");
+}
+
+// After fork the child shares the parent's pages until one of
+// them writes.  Writes, including ones the kernel makes on the
+// process's behalf in read(), must stay private to the writer.
+void
+cowtest(void)
+{
+  char *p, *oldbrk;
+  int fds[2], i, pid;
+
+  printf(stdout, "cow test\n");
+  oldbrk = sbrk(0);
+  p = sbrk(16*4096);
+  if(p == (char*)0xffffffff){
+    printf(stdout, "cow test sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 16; i++)
+    p[i*4096] = i;
+  if(pipe(fds) != 0){
+    printf(stdout, "cow test pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[1]);
+    if(read(fds[0], p + 4096, 1) != 1 || p[4096] != 'x'){
+      printf(stdout, "cow test child read failed\n");
+      exit();
+    }
+    for(i = 2; i < 16; i++){
+      if(p[i*4096] != i){
+        printf(stdout, "cow test child sees wrong data\n");
+        exit();
+      }
+      p[i*4096] = 'c';
+    }
+    exit();
+  }
+  close(fds[0]);
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait();
+
+  for(i = 0; i < 16; i++){
+    if(p[i*4096] != i){
+      printf(stdout, "cow test parent page %d changed\n", i);
+      exit();
+    }
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "cow test OK\n");
+}
+
+// Pages that are read before they are written share one zero
+// page; a write must give the page its own zeroed frame.
+void
+zeropagetest(void)
+{
+  char *p, *oldbrk;
+  int i, sum;
+
+  printf(stdout, "zero page test\n");
+  oldbrk = sbrk(0);
+  p = sbrk(64*4096);
+  if(p == (char*)0xffffffff){
+    printf(stdout, "zero page test sbrk failed\n");
+    exit();
+  }
+  sum = 0;
+  for(i = 0; i < 64; i++)
+    sum += p[i*4096 + 1 + i];
+  p[5*4096 + 7] = 1;
+  for(i = 0; i < 64; i++)
+    sum += p[i*4096 + 7];
+  if(sum != 1){
+    printf(stdout, "zero page test sum %d\n", sum);
+    exit();
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "zero page test OK\n");
+}
+
+// Private file and anonymous mappings.
+void
+mmaptest(void)
+{
+  char *p;
+  int fd, i, n;
+
+  printf(stdout, "mmap test\n");
+  n = 4096 + 100;
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "mmap test create failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, n) != n){
+    printf(stdout, "mmap test write failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    printf(stdout, "mmap test mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != (char)(i % 251)){
+      printf(stdout, "mmap test wrong data at %d\n", i);
+      exit();
+    }
+  }
+  for(; i < 2*4096; i++){
+    if(p[i] != 0){
+      printf(stdout, "mmap test nonzero past end of file\n");
+      exit();
+    }
+  }
+  // Writes stay private.
+  p[0] = 'Z';
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != 0){
+    printf(stdout, "mmap test write reached the file\n");
+    exit();
+  }
+  close(fd);
+  if(munmap(p, n) < 0){
+    printf(stdout, "mmap test munmap failed\n");
+    exit();
+  }
+  unlink("mmapfile");
+
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf(stdout, "mmap test anonymous mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 3*4096; i += 512){
+    if(p[i] != 0){
+      printf(stdout, "mmap test anonymous page not zero\n");
+      exit();
+    }
+    p[i] = 1;
+  }
+  if(munmap(p, 3*4096) < 0){
+    printf(stdout, "mmap test munmap failed\n");
+    exit();
+  }
+  printf(stdout, "mmap test OK\n");
+}
+
+// Resident pages of this process.
+int
+myrss(void)
+{
+  struct pstat st;
+
+  mystat(&st);
+  return st.rss;
+}
+
+// madvise(MADV_DONTNEED) and a shrinking sbrk must give
+// the frames back, and the dropped range must read as zero.
+// The resident counts leave some slack for text pages that
+// fault in along the way.
+void
+dontneedtest(void)
+{
+  char *p;
+  int i, rss;
+
+  printf(stdout, "dontneed test\n");
+  if((uint)sbrk(0) % 4096)
+    sbrk(4096 - (uint)sbrk(0) % 4096);
+  p = sbrk(32*4096);
+  for(i = 0; i < 32; i++)
+    p[i*4096] = 1;
+  rss = myrss();
+  if(madvise(p, 32*4096, MADV_DONTNEED) < 0){
+    printf(stdout, "dontneed test madvise failed\n");
+    exit();
+  }
+  if(myrss() > rss - 24){
+    printf(stdout, "dontneed test madvise kept pages\n");
+    exit();
+  }
+  for(i = 0; i < 32; i++){
+    if(p[i*4096] != 0){
+      printf(stdout, "dontneed test page %d not zero\n", i);
+      exit();
+    }
+    p[i*4096] = 1;
+  }
+  rss = myrss();
+  if(sbrk(-32*4096) != p + 32*4096){
+    printf(stdout, "dontneed test sbrk failed\n");
+    exit();
+  }
+  if(myrss() > rss - 24){
+    printf(stdout, "dontneed test sbrk kept pages\n");
+    exit();
+  }
+  printf(stdout, "dontneed test OK\n");
+}
+
+// Pages written out by all processes so far.
+uint
+swapouts(void)
+{
+  static struct pstat ps[NPROC];
+  int i, n;
+  uint total;
+
+  n = getpstat(ps, NPROC);
+  total = 0;
+  for(i = 0; i < n; i++)
+    total += ps[i].nswapout;
+  return total;
+}
+
+// Fill a page with data the compressed pool will not take,
+// so that paging it out writes it to disk.
+void
+noisepage(char *p, uint seed)
+{
+  int i;
+
+  for(i = 0; i < 4096; i += 4){
+    seed = seed * 1103515245 + 12345;
+    *(uint*)(p + i) = seed;
+  }
+}
+
+// Whether p still holds what noisepage(p, seed) put there.
+int
+noiseok(char *p, uint seed)
+{
+  int i;
+
+  for(i = 0; i < 4096; i += 4){
+    seed = seed * 1103515245 + 12345;
+    if(*(uint*)(p + i) != seed)
+      return 0;
+  }
+  return 1;
+}
+
+// fork shares the parent's swapped-out pages with the child.
+// Both must fault them back in intact, from disk and from the
+// compressed pool, and a write by either must stay private.
+#define SFPAGES 64
+
+int
+sfpageok(char *p, int i)
+{
+  if(i % 2)
+    return p[0] == i && p[4095] == i;
+  return noiseok(p, i);
+}
+
+void
+swapforktest(void)
+{
+  struct pstat st0, st1;
+  char *p, *oldbrk;
+  int i, pid, oldlimit;
+
+  printf(stdout, "swap fork test\n");
+  oldbrk = sbrk(0);
+  if((uint)oldbrk % 4096)
+    sbrk(4096 - (uint)oldbrk % 4096);
+  p = sbrk(SFPAGES*4096);
+  if(p == (char*)-1){
+    printf(stdout, "swap fork test sbrk failed\n");
+    exit();
+  }
+  mystat(&st0);
+  // Odd pages compress well and go to the pool; the
+  // others do not, and go to disk.
+  for(i = 0; i < SFPAGES; i++){
+    if(i % 2)
+      memset(p + i*4096, i, 4096);
+    else
+      noisepage(p + i*4096, i);
+  }
+  oldlimit = rsslimit(st0.rss + 1);
+  mystat(&st1);
+  rsslimit(oldlimit);
+  if(st1.nswapout - st0.nswapout < SFPAGES/2){
+    printf(stdout, "swap fork test: only %d pages paged out\n",
+           st1.nswapout - st0.nswapout);
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "swap fork test fork failed\n");
+    exit();
+  }
+  for(i = 0; i < SFPAGES; i++){
+    if(!sfpageok(p + i*4096, i)){
+      printf(stdout, "swap fork test %s page %d corrupt\n",
+             pid ? "parent" : "child", i);
+      exit();
+    }
+    if(pid == 0)
+      p[i*4096] = 'c';
+  }
+  if(pid == 0)
+    exit();
+  wait();
+  for(i = 0; i < SFPAGES; i++){
+    if(!sfpageok(p + i*4096, i)){
+      printf(stdout, "swap fork test child's write reached parent\n");
+      exit();
+    }
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "swap fork test OK\n");
+}
+
+// Fill swap, then free every other slot, so that no run of
+// SWAPCLUSTER free slots is left.  Reclaim must still make
+// progress by writing dirty pages out in shorter runs.
+#define FRAGPAGES (NSWAPSLOT + 512)
+#define FRAGNEW   256
+
+void
+swapfragtest(void)
+{
+  struct pstat st0, st1;
+  char *p, *q, *oldbrk;
+  int i, oldlimit;
+
+  printf(stdout, "swap frag test\n");
+  oldbrk = sbrk(0);
+  if((uint)oldbrk % 4096)
+    sbrk(4096 - (uint)oldbrk % 4096);
+  p = sbrk(FRAGPAGES*4096);
+  q = sbrk(FRAGNEW*4096);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf(stdout, "swap frag test sbrk failed\n");
+    exit();
+  }
+  mystat(&st0);
+  oldlimit = rsslimit(st0.rss + 64);
+  for(i = 0; i < FRAGPAGES; i++)
+    noisepage(p + i*4096, i);
+  for(i = 0; i < NSWAPSLOT; i += 2)
+    madvise(p + i*4096, 4096, MADV_DONTNEED);
+
+  mystat(&st0);
+  rsslimit(st0.rss);
+  for(i = 0; i < FRAGNEW; i++)
+    noisepage(q + i*4096, i);
+  mystat(&st1);
+  rsslimit(oldlimit);
+  sbrk(-(sbrk(0) - oldbrk));
+
+  if(st1.nswapout - st0.nswapout < FRAGNEW/2){
+    printf(stdout, "swap frag test: %d pages written out, "
+           "resident %d of %d\n", st1.nswapout - st0.nswapout,
+           st1.rss, st0.rss);
+    exit();
+  }
+  printf(stdout, "swap frag test OK\n");
+}
+
+// Roughly how many pages can be touched before the kernel
+// starts paging out: grow the heap a megabyte at a time until
+// some page is written out, then give it all back.
+int
+freepages(void)
+{
+  char *p;
+  int i, n;
+  uint base;
+
+  if((uint)sbrk(0) % 4096)
+    sbrk(4096 - (uint)sbrk(0) % 4096);
+  base = swapouts();
+  for(n = 0; swapouts() == base; n += 256){
+    if((p = sbrk(256*4096)) == (char*)-1)
+      break;
+    for(i = 0; i < 256; i++)
+      p[i*4096] = 1;
+  }
+  sbrk(-n*4096);
+  return n;
+}
+
+// Compressed swap under real memory pressure: touch more pages
+// than are free, all of which compress well.  Reclaim stores
+// them in the pool, which must allocate its own pages out of
+// what little memory is left, and fall back on disk when it
+// cannot.  Every page must come back intact.
+#define ZTEXTRA 2048
+
+void
+zswaptest(void)
+{
+  struct pstat st0, st1;
+  char *p, *oldbrk;
+  int i, n;
+
+  printf(stdout, "zswap test\n");
+  n = freepages() + ZTEXTRA;
+  oldbrk = sbrk(0);
+  p = sbrk(n*4096);
+  if(p == (char*)-1){
+    printf(stdout, "zswap test sbrk failed\n");
+    exit();
+  }
+  mystat(&st0);
+  for(i = 0; i < n; i++){
+    memset(p + i*4096, i, 4096);
+    *(int*)(p + i*4096) = i;
+  }
+  mystat(&st1);
+  if(st1.nswapout == st0.nswapout){
+    printf(stdout, "zswap test: nothing paged out\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(*(int*)(p + i*4096) != i || p[i*4096 + 4095] != (char)i){
+      printf(stdout, "zswap test page %d corrupt\n", i);
+      exit();
+    }
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "zswap test OK\n");
+}
+
+// Many processes faulting at once, each forking so that its
+// children share frames copy-on-write while they write, drop
+// and refault their pages.  Between them, at the moment each
+// child has copied its parent's pages, they use more memory
+// than is free, so reclaim pages out some processes while
+// others fault.  A bit more is asked for than is free, which
+// swap can take; if memory does run out, some are killed.
+// Run with make CPUS=8 qemu, where the faults of different
+// processes really are concurrent.
+#define FSPROCS  8
+#define FSROUNDS 2
+
+void
+faultstress(void)
+{
+  char *p;
+  int i, j, k, pid, round, npages;
+
+  printf(stdout, "fault stress test\n");
+  npages = (freepages() + 2048) / (2*FSPROCS);
+  printf(stdout, "fault stress: %d processes of %d pages\n", FSPROCS, npages);
+  for(i = 0; i < FSPROCS; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "fault stress fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      if((uint)sbrk(0) % 4096)
+        sbrk(4096 - (uint)sbrk(0) % 4096);
+      p = sbrk(npages*4096);
+      if(p == (char*)-1){
+        printf(stdout, "fault stress sbrk failed\n");
+        exit();
+      }
+      for(round = 0; round < FSROUNDS; round++){
+        for(j = 0; j < npages; j++)
+          p[j*4096 + i] = i + j + round;
+        pid = fork();
+        if(pid < 0){
+          printf(stdout, "fault stress fork failed\n");
+          exit();
+        }
+        for(j = 0; j < npages; j++){
+          if(p[j*4096 + i] != (char)(i + j + round)){
+            printf(stdout, "fault stress bad data\n");
+            exit();
+          }
+          if(pid == 0)
+            p[j*4096 + i] = 0;
+        }
+        if(pid == 0){
+          madvise(p, npages*4096, MADV_DONTNEED);
+          for(k = 0; k < npages*4096; k += 4096)
+            if(p[k + i] != 0){
+              printf(stdout, "fault stress not zero\n");
+              exit();
+            }
+          exit();
+        }
+        wait();
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < FSPROCS; i++)
+    wait();
+  printf(stdout, "fault stress test OK\n");
+}
+
+// A process that touches more memory than there is, swap
+// included, must be killed instead of hanging the machine.
+// The child grows its heap until sbrk fails; it only gets
+// there without being killed when RAM plus swap exceeds the
+// user address space, in which case the test is skipped.
+void
+oomtest(void)
+{
+  char *p;
+  int i, pid, fds[2];
+
+  printf(stdout, "oom test\n");
+  if(pipe(fds) < 0){
+    printf(stdout, "oom test pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "oom test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    while((p = sbrk(1024*1024)) != (char*)-1)
+      for(i = 0; i < 1024*1024; i += 4096)
+        p[i] = i >> 12;
+    write(fds[1], "x", 1);
+    exit();
+  }
+  close(fds[1]);
+  wait();
+  if(read(fds[0], &i, 1) != 0){
+    printf(stdout, "oom test skipped: address space ran out first\n");
+    close(fds[0]);
+    return;
+  }
+  close(fds[0]);
+  printf(stdout, "oom test OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "vmtests starting\n");
+
+  pstattest();
+  clocktest();
+  cowtest();
+  zeropagetest();
+  mmaptest();
+  dontneedtest();
+  swapforktest();
+  swapfragtest();
+  zswaptest();
+  faultstress();
+  oomtest();
+
+  printf(1, "ALL VM TESTS PASSED\n");
+  exit();
+}
@@ -0,0 +1,275 @@
+// Compressed swap in memory.
+//
+// page_out first tries to compress a dirty victim into a pool
+// of kalloc'd pages, and writes it to the swap area on disk only
+// if it does not compress well or the pool is full.  A fault on
+// a page in the pool decompresses it without any disk I/O.
+//
+// Entries in the pool are numbered from NSWAPSLOT up, so they
+// fit in a PTE_SWAP entry like a disk slot and swapfree and
+// swapdup can tell the two apart.  Each entry occupies a run of
+// ZCHUNK-byte chunks within one pool page; a pool page goes back
+// to the allocator when its last entry is freed.
+//
+// The codec is a byte-oriented LZ77: a control byte below 0x80
+// introduces that many plus one literal bytes, and one at or
+// above 0x80 a match of (c & 0x7F) + 3 bytes copied from a
+// 16-bit distance back in the output.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define ZCHUNK     256                          // allocation unit in the pool
+#define ZPERPAGE   (PGSIZE/ZCHUNK)              // chunks per pool page
+#define NZSLOT     (ZPOOLPAGES*ZPERPAGE)        // most entries the pool can hold
+#define ZMAXLEN    (PGSIZE*3/4)                 // store only pages that shrink this far
+#define ZHASHBITS  10
+#define MINMATCH   3
+#define MAXMATCH   (0x7F + MINMATCH)
+#define MAXLIT     0x80
+
+struct zslot {
+  short page;    // index in zswap.pool
+  uchar chunk;   // first chunk in the page
+  uchar nchunk;  // 0 if the entry is free
+  ushort len;    // compressed length
+  uchar ref;     // page table entries referring to it
+};
+
+struct {
+  struct spinlock lock;
+  struct {
+    char *mem;   // 0 if not allocated
+    ushort used; // bit i set if chunk i is in use
+  } pool[ZPOOLPAGES];
+  struct zslot slot[NZSLOT];
+  int hint;      // where to start looking for a free slot
+  ushort hash[1<<ZHASHBITS];  // compressor match finder
+  uchar buf[ZMAXLEN];         // compressor output
+} zswap;
+
+void
+zswapinit(void)
+{
+  initlock(&zswap.lock, "zswap");
+}
+
+#define HASH(p) ((((p)[0] << 8) ^ ((p)[1] << 4) ^ (p)[2]) & ((1<<ZHASHBITS) - 1))
+
+// Compress the page at src into zswap.buf.  Returns the
+// compressed length, or -1 if it would exceed ZMAXLEN.
+static int
+lzcompress(uchar *src)
+{
+  uchar *dst;
+  int i, lit, n, len, cand, h, off;
+
+  dst = zswap.buf;
+  memset(zswap.hash, 0, sizeof(zswap.hash));
+  n = lit = i = 0;
+  while(i < PGSIZE){
+    len = 0;
+    if(i + MINMATCH <= PGSIZE){
+      h = HASH(src + i);
+      cand = zswap.hash[h] - 1;
+      zswap.hash[h] = i + 1;
+      if(cand >= 0 && cand < i && memcmp(src + cand, src + i, MINMATCH) == 0){
+        len = MINMATCH;
+        while(i + len < PGSIZE && len < MAXMATCH && src[cand + len] == src[i + len])
+          len++;
+      }
+    }
+    if(len == 0 && i - lit < MAXLIT){
+      i++;
+      continue;
+    }
+    if(i > lit){
+      if(n + 1 + (i - lit) > ZMAXLEN)
+        return -1;
+      dst[n++] = i - lit - 1;
+      memmove(dst + n, src + lit, i - lit);
+      n += i - lit;
+      lit = i;
+    }
+    if(len > 0){
+      if(n + 3 > ZMAXLEN)
+        return -1;
+      off = i - cand;
+      dst[n++] = 0x80 | (len - MINMATCH);
+      dst[n++] = off & 0xFF;
+      dst[n++] = off >> 8;
+      i += len;
+      lit = i;
+    }
+  }
+  if(i > lit){
+    if(n + 1 + (i - lit) > ZMAXLEN)
+      return -1;
+    dst[n++] = i - lit - 1;
+    memmove(dst + n, src + lit, i - lit);
+    n += i - lit;
+  }
+  return n;
+}
+
+// Decompress n bytes at src into the page at dst.
+static void
+lzdecompress(uchar *src, int n, uchar *dst)
+{
+  int i, o, c, len, off;
+
+  i = o = 0;
+  while(i < n){
+    c = src[i++];
+    if(c & 0x80){
+      len = (c & 0x7F) + MINMATCH;
+      if(i + 2 > n)
+        panic("lzdecompress");
+      off = src[i] | (src[i+1] << 8);
+      i += 2;
+      if(off == 0 || off > o || o + len > PGSIZE)
+        panic("lzdecompress");
+      for(; len > 0; len--, o++)
+        dst[o] = dst[o - off];
+    } else {
+      len = c + 1;
+      if(i + len > n || o + len > PGSIZE)
+        panic("lzdecompress");
+      memmove(dst + o, src + i, len);
+      i += len;
+      o += len;
+    }
+  }
+  if(o != PGSIZE)
+    panic("lzdecompress: short");
+}
+
+// Find nchunk free chunks in a row in some pool page, allocating
+// a new pool page if need be.  Returns the page index and sets
+// *chunk, or returns -1.  Called with zswap.lock held.
+static int
+zalloc(int nchunk, int *chunk)
+{
+  int p, c, free;
+  ushort m;
+
+  m = (1 << nchunk) - 1;
+  free = -1;
+  for(p = 0; p < ZPOOLPAGES; p++){
+    if(zswap.pool[p].mem == 0){
+      if(free < 0)
+        free = p;
+      continue;
+    }
+    for(c = 0; c + nchunk <= ZPERPAGE; c++){
+      if((zswap.pool[p].used & (m << c)) == 0){
+        *chunk = c;
+        return p;
+      }
+    }
+  }
+  if(free < 0 || (zswap.pool[free].mem = kalloc()) == 0)
+    return -1;
+  zswap.pool[free].used = 0;
+  *chunk = 0;
+  return free;
+}
+
+// Compress the page at mem into the pool.  Returns its slot
+// number, or -1 if it does not compress well enough or there
+// is no room.
+int
+zswapstore(char *mem)
+{
+  struct zslot *z;
+  int i, n, nchunk, p, c;
+
+  acquire(&zswap.lock);
+  if((n = lzcompress((uchar*)mem)) < 0)
+    goto fail;
+  for(i = 0; i < NZSLOT; i++){
+    z = &zswap.slot[(zswap.hint + i) % NZSLOT];
+    if(z->nchunk == 0)
+      break;
+  }
+  if(i == NZSLOT)
+    goto fail;
+  nchunk = (n + ZCHUNK - 1) / ZCHUNK;
+  if((p = zalloc(nchunk, &c)) < 0)
+    goto fail;
+  zswap.pool[p].used |= ((1 << nchunk) - 1) << c;
+  memmove(zswap.pool[p].mem + c*ZCHUNK, zswap.buf, n);
+  z->page = p;
+  z->chunk = c;
+  z->nchunk = nchunk;
+  z->len = n;
+  z->ref = 1;
+  i = z - zswap.slot;
+  zswap.hint = (i + 1) % NZSLOT;
+  release(&zswap.lock);
+  return NSWAPSLOT + i;
+
+fail:
+  release(&zswap.lock);
+  return -1;
+}
+
+static struct zslot*
+zslot(int s)
+{
+  s -= NSWAPSLOT;
+  if(s < 0 || s >= NZSLOT || zswap.slot[s].nchunk == 0)
+    panic("zslot");
+  return &zswap.slot[s];
+}
+
+// Decompress slot s into the page at mem.
+void
+zswapread(int s, char *mem)
+{
+  struct zslot *z;
+
+  acquire(&zswap.lock);
+  z = zslot(s);
+  lzdecompress((uchar*)zswap.pool[z->page].mem + z->chunk*ZCHUNK, z->len,
+               (uchar*)mem);
+  release(&zswap.lock);
+}
+
+void
+zswapdup(int s)
+{
+  struct zslot *z;
+
+  acquire(&zswap.lock);
+  z = zslot(s);
+  if(z->ref == 255)
+    panic("zswapdup: ref");
+  z->ref++;
+  release(&zswap.lock);
+}
+
+// Drop a reference to slot s, freeing its chunks with the
+// last one and the pool page once it is empty.
+void
+zswapfree(int s)
+{
+  struct zslot *z;
+  int p;
+
+  acquire(&zswap.lock);
+  z = zslot(s);
+  if(--z->ref == 0){
+    p = z->page;
+    zswap.pool[p].used &= ~(((1 << z->nchunk) - 1) << z->chunk);
+    z->nchunk = 0;
+    if(zswap.pool[p].used == 0){
+      kfree(zswap.pool[p].mem);
+      zswap.pool[p].mem = 0;
+    }
+  }
+  release(&zswap.lock);
+}